@@ -20,6 +20,9 @@
 #define NEED_sv_2pv_nolen
 #include "ppport.h"
 #include "sombok.h"
+#ifdef HAS_MMAP
+#  include <sys/mman.h>
+#endif /* HAS_MMAP */
 
 /* for Win32 with Visual Studio (MSVC) */
 #ifdef _MSC_VER
@@ -33,10 +36,99 @@
 typedef IV swapspec_t;
 typedef gcstring_t *generic_string;
 
+/*
+ * Fragments of text, each of which is unbreakable text followed by SPACEs
+ * and newline.  Clusters of the whole text and fragments are kept as
+ * arrays so that layout may stream through them; grapheme cluster
+ * strings are made only when they are required.
+ */
+typedef struct {
+    linebreak_t *lbobj;	/* owner of strings made from fragments */
+    unichar_t *str;	/* whole text */
+    size_t textlen;
+    size_t textsiz;
+    U32 *idx;		/* offset of clusters; idx[nclusters] is textlen */
+    unsigned char *lbc;	/* properties of clusters */
+    unsigned char *elbc;
+    unsigned char *flag;
+    unsigned char *width;
+    size_t nclusters;
+    size_t gcsiz;
+    U32 *beg;		/* first cluster; beg[len] is nclusters */
+    U32 *spc;		/* first cluster of SPACEs */
+    unsigned char *brk;	/* kind of break after the fragment */
+    double *cols;	/* cached size but SPACEs, or negative */
+    double *spccols;	/* cached size of SPACEs */
+    size_t len;		/* number of fragments */
+    size_t siz;
+} fragments_t;
+
+/* Text prepared for layout. */
+typedef struct {
+    linebreak_t *lbobj;
+    fragments_t *frags;
+    double colmax;	/* original configuration */
+    double colmin;
+    size_t charmax;
+    unsigned int options;
+} prepared_t;
+
+/* Editable grapheme cluster string kept in gap buffers. */
+typedef struct {
+    linebreak_t *lbobj;
+    unichar_t *str;
+    size_t len;		/* number of characters */
+    size_t siz;
+    size_t gap;		/* gap of characters starts here */
+    gcchar_t *gcstr;
+    size_t gclen;	/* number of clusters */
+    size_t gcsiz;
+    size_t gcgap;	/* gap of clusters starts here */
+} gceditor_t;
+
 /***
  *** Data conversion.
  ***/
 
+/*
+ * Length of leading 7-bit characters in buffer S, examined a word at a
+ * time.  Most of texts consist of them only and need not be decoded.
+ */
+static
+size_t ascii_span(const U8 *s, size_t len)
+{
+    size_t i = 0;
+#ifndef EBCDIC
+    const UV hibits = (~(UV)0 / 0xFF) * 0x80;
+    UV w;
+
+    for (; i + sizeof(UV) <= len; i += sizeof(UV)) {
+	memcpy(&w, s + i, sizeof(UV));
+	if (w & hibits)
+	    break;
+    }
+    for (; i < len && s[i] < 0x80; i++)
+	;
+#endif /* EBCDIC */
+    return i;
+}
+
+/*
+ * Decode a character at UTF8PTR.  Its length is stored into LEN.
+ */
+static
+unichar_t utf8_decode_char(U8 *utf8ptr, U8 *end, STRLEN *len)
+{
+#if PERL_VERSION >= 20 || (PERL_VERSION == 19 && PERL_SUBVERSION >= 4)
+    return (unichar_t) NATIVE_TO_UNI(utf8_to_uvchr_buf(utf8ptr, end, len));
+#elif PERL_VERSION >= 16 || (PERL_VERSION == 15 && PERL_SUBVERSION >= 9)
+    return (unichar_t) utf8_to_uvuni_buf(utf8ptr, end, len);
+#else
+    return (unichar_t) utf8n_to_uvuni(utf8ptr, end - utf8ptr, len,
+				      ckWARN(WARN_UTF8) ? 0 : UTF8_ALLOW_ANY);
+#endif
+}
+
 /*
  * Create Unicode string from Perl utf8-flagged string.
  */
@@ -44,7 +136,7 @@ static
 unistr_t *SVtounistr(unistr_t *buf, SV *str)
 {
     U8 *utf8, *utf8ptr;
-    STRLEN utf8len, unilen, len;
+    STRLEN utf8len, unilen, asciilen, len;
     unichar_t *uniptr;
 
     if (buf == NULL) {
@@ -61,25 +153,24 @@ unistr_t *SVtounistr(unistr_t *buf, SV *str)
 	return buf;
     if (utf8len <= 0)
 	return buf;
-    unilen = utf8_length(utf8, utf8 + utf8len);
+    asciilen = ascii_span(utf8, utf8len);
+    unilen = asciilen;
+    if (asciilen < utf8len)
+	unilen += utf8_length(utf8 + asciilen, utf8 + utf8len);
     if ((buf->str = (unichar_t *)malloc(sizeof(unichar_t) * unilen)) == NULL)
 	croak("SVtounistr: %s", strerror(errno));
 
-    utf8ptr = utf8;
     uniptr = buf->str;
+    for (utf8ptr = utf8; utf8ptr < utf8 + asciilen; utf8ptr++)
+	*uniptr++ = (unichar_t)*utf8ptr;
     while (utf8ptr < utf8 + utf8len) {
-#if PERL_VERSION >= 20 || (PERL_VERSION == 19 && PERL_SUBVERSION >= 4)
-	*uniptr = (unichar_t) NATIVE_TO_UNI(
-	    utf8_to_uvchr_buf(utf8ptr, utf8 + utf8len, &len));
-#elif PERL_VERSION >= 16 || (PERL_VERSION == 15 && PERL_SUBVERSION >= 9)
-	*uniptr = (unichar_t) utf8_to_uvuni_buf(utf8ptr, utf8 + utf8len,
-						&len);
-#else
-	*uniptr = (unichar_t) utf8n_to_uvuni(utf8ptr,
-					     utf8 + utf8len - utf8ptr, &len,
-					     ckWARN(WARN_UTF8) ? 0 :
-					     UTF8_ALLOW_ANY);
-#endif
+#ifndef EBCDIC
+	if (*utf8ptr < 0x80) {
+	    *uniptr++ = (unichar_t)*utf8ptr++;
+	    continue;
+	}
+#endif /* EBCDIC */
+	*uniptr = utf8_decode_char(utf8ptr, utf8 + utf8len, &len);
 	if (len < 0) {
 	    free(buf->str);
 	    buf->str = NULL;
@@ -132,44 +223,53 @@ unistr_t *SVupgradetounistr(unistr_t *buf, SV *str)
 }
 
 /*
- * Create Perl utf8-flagged string from Unicode string.
+ * Create Perl utf8-flagged string from Unicode string.  Buffer is
+ * allocated for 7-bit characters first and grown when others appear.
  */
 static
 SV *unistrtoSV(unistr_t *unistr, size_t uniidx, size_t unilen)
 {
-    U8 *buf = NULL, *newbuf;
-    STRLEN utf8len;
-    unichar_t *uniptr;
+    U8 *buf;
+    STRLEN utf8len, siz;
+    unichar_t *uniptr, *end;
     SV *utf8;
 
-    if (unistr == NULL || unistr->str == NULL || unilen == 0) {
+    if (unistr == NULL || unistr->str == NULL || unilen == 0 ||
+	unistr->len <= uniidx) {
 	utf8 = newSVpvn("", 0);
 	SvUTF8_on(utf8);
 	return utf8;
     }
+    if (unistr->len - uniidx < unilen)
+	unilen = unistr->len - uniidx;
 
-    utf8len = 0;
     uniptr = unistr->str + uniidx;
-    while (uniptr < unistr->str + uniidx + unilen &&
-	   uniptr < unistr->str + unistr->len) {
-	if ((newbuf = realloc(buf,
-			      sizeof(U8) * (utf8len + UTF8_MAXLEN + 1)))
-	    == NULL) {
-	    free(buf);
-	    croak("unistrtoSV: %s", strerror(errno));
+    end = uniptr + unilen;
+    siz = unilen + UTF8_MAXLEN + 1;
+    utf8 = newSV(siz);
+    buf = (U8 *)SvPVX(utf8);
+    utf8len = 0;
+    for (; uniptr < end; uniptr++) {
+#ifndef EBCDIC
+	if (*uniptr < 0x80) {
+	    buf[utf8len++] = (U8)*uniptr;
+	    continue;
+	}
+#endif /* EBCDIC */
+	if (siz < utf8len + (end - uniptr) + UTF8_MAXLEN + 1) {
+	    siz = (utf8len + (end - uniptr)) * 2 + UTF8_MAXLEN + 1;
+	    buf = (U8 *)SvGROW(utf8, siz);
 	}
-	buf = newbuf;
 #if PERL_VERSION >= 20 || (PERL_VERSION == 19 && PERL_SUBVERSION >= 4)
 	utf8len = uvchr_to_utf8(buf + utf8len, UNI_TO_NATIVE(*uniptr)) - buf;
 #else
 	utf8len = uvuni_to_utf8(buf + utf8len, *uniptr) - buf;
 #endif
-	uniptr++;
     }
-
-    utf8 = newSVpvn((char *)(void *)buf, utf8len);
+    buf[utf8len] = '\0';
+    SvCUR_set(utf8, utf8len);
+    SvPOK_only(utf8);
     SvUTF8_on(utf8);
-    free(buf);
     return utf8;
 }
 
@@ -182,11 +282,21 @@ SV *unistrtoSV(unistr_t *unistr, size_t uniidx, size_t unilen)
 /*
  * Create Perl object from C object
  */
+#ifdef USE_ITHREADS
+static void setCtoPerl_magic(pTHX_ SV *, char *);
+# define setCtoPerl(arg, klass, var) \
+    STMT_START { \
+	sv_setref_iv(arg, klass, (IV)(var)); \
+	SvREADONLY_on(arg); \
+	setCtoPerl_magic(aTHX_ SvRV(arg), klass); \
+    } STMT_END
+#else /* USE_ITHREADS */
 # define setCtoPerl(arg, klass, var) \
     STMT_START { \
 	sv_setref_iv(arg, klass, (IV)(var)); \
 	SvREADONLY_on(arg); \
     } STMT_END
+#endif /* USE_ITHREADS */
 static
 SV *CtoPerl(char *klass, void *obj)
 {
@@ -197,6 +307,94 @@ SV *CtoPerl(char *klass, void *obj)
     return sv;
 }
 
+/*
+ * Create grapheme cluster string from Unicode string STR, which is taken
+ * over.  Clusters of 7-bit text are single characters but CR LF, so long
+ * 7-bit text is not segmented: Properties of clusters are learned from
+ * the library by segmenting all 7-bit characters once.  SPACE followed
+ * by combining mark (C0 control under LegacyCM) depends on context, so
+ * such text is segmented by the library.  Returns NULL on error.
+ */
+#define ASCII_GCSTRING_MIN (512)
+
+static
+gcstring_t *ascii_gcstring_new(unistr_t *str, linebreak_t *lbobj)
+{
+    unichar_t probe[130];
+    unistr_t unistr = {probe, 130};
+    gcstring_t *tab, *ret;
+    gcchar_t *gc;
+    size_t i, n;
+
+    if (str == NULL || str->len < ASCII_GCSTRING_MIN)
+	return gcstring_new(str, lbobj);
+    for (i = 0; i < str->len; i++)
+	if (0x7F < str->str[i])
+	    return gcstring_new(str, lbobj);
+
+    /* All 7-bit characters followed by CR LF. */
+    for (i = 0; i < 128; i++)
+	probe[i] = (unichar_t)i;
+    probe[128] = 0x0D;
+    probe[129] = 0x0A;
+    if ((tab = gcstring_newcopy(&unistr, lbobj)) == NULL)
+	return NULL;
+    if (tab->gclen != 129 || tab->gcstr[128].len != 2) {
+	gcstring_destroy(tab);
+	return gcstring_new(str, lbobj);
+    }
+    for (i = 0; i + 1 < str->len; i++)
+	if (tab->gcstr[str->str[i]].lbc == LB_SP &&
+	    tab->gcstr[str->str[i + 1]].lbc == LB_CM) {
+	    gcstring_destroy(tab);
+	    return gcstring_new(str, lbobj);
+	}
+
+    if ((ret = gcstring_new(NULL, lbobj)) == NULL ||
+	(ret->gcstr = malloc(sizeof(gcchar_t) * str->len)) == NULL) {
+	gcstring_destroy(ret);
+	gcstring_destroy(tab);
+	return NULL;
+    }
+    for (i = 0, n = 0; i < str->len; n++) {
+	gc = ret->gcstr + n;
+	if (str->str[i] == 0x0D && i + 1 < str->len &&
+	    str->str[i + 1] == 0x0A)
+	    *gc = tab->gcstr[128];
+	else
+	    *gc = tab->gcstr[str->str[i]];
+	gc->idx = i;
+	i += gc->len;
+    }
+    gcstring_destroy(tab);
+    ret->str = str->str;
+    ret->len = str->len;
+    ret->gclen = n;
+    str->str = NULL;
+    str->len = 0;
+    return ret;
+}
+
+/*
+ * Same as ascii_gcstring_new() but STR is copied.
+ */
+static
+gcstring_t *ascii_gcstring_newcopy(unistr_t *str, linebreak_t *lbobj)
+{
+    unistr_t unistr = {NULL, 0};
+    gcstring_t *ret;
+
+    if (str->str != NULL && str->len) {
+	if ((unistr.str = malloc(sizeof(unichar_t) * str->len)) == NULL)
+	    return NULL;
+	memcpy(unistr.str, str->str, sizeof(unichar_t) * str->len);
+	unistr.len = str->len;
+    }
+    if ((ret = ascii_gcstring_new(&unistr, lbobj)) == NULL)
+	free(unistr.str);
+    return ret;
+}
+
 /*
  * Convert Perl utf8-flagged string (GCString) to grapheme cluster string.
  */
@@ -207,7 +405,7 @@ gcstring_t *SVtogcstring(SV *sv, linebreak_t *lbobj)
 
     if (!sv_isobject(sv)) {
 	SVtounistr(&unistr, sv);
-	return gcstring_new(&unistr, lbobj);
+	return ascii_gcstring_new(&unistr, lbobj);
     } else if (sv_derived_from(sv, "Unicode::GCString"))
 	return PerltoC(gcstring_t *, sv);
     else
@@ -246,311 +444,3960 @@ int SVtoboolean(SV *sv)
     return SvNV(sv) != 0.0;
 }
 
-/***
- *** Other utilities
- ***/
-
 /*
- * Do regex match once then returns offset and length.
+ * Convert tailoring map to Perl array reference.
+ * Each element is [[ORD, ...] => PROP] or, if ranges is true,
+ * [[[BEG, END], ...] => PROP].  PROP is taken from lbc or eaw field.
  */
-void do_pregexec_once(REGEXP *rx, unistr_t *str)
+static
+SV *maptoSV(linebreak_t *obj, int eaw, int ranges)
 {
-    SV *screamer;
-    char *str_arg, *str_beg, *str_end;
-    size_t offs_beg, offs_end;
+    AV *av, *codes = NULL, *ret = NULL;
+    propval_t p = PROP_UNKNOWN, q;
+    unichar_t c, beg = 0, end = 0;
+    size_t i;
 
-    screamer = unistrtoSV(str, 0, str->len);
-    SvREADONLY_on(screamer);
-    str_beg = str_arg = SvPVX(screamer);
-    str_end = SvEND(screamer);
+    if (obj->map == NULL || obj->mapsiz == 0)
+	return NULL;
 
-    if (pregexec(rx, str_arg, str_end, str_beg, 0, screamer, 1)) {
-#if PERL_VERSION >= 11
-	offs_beg = ((regexp *)SvANY(rx))->offs[0].start;
-	offs_end = ((regexp *)SvANY(rx))->offs[0].end;
-#elif ((PERL_VERSION == 10) || (PERL_VERSION == 9 && PERL_SUBVERSION >= 5))
-	offs_beg = rx->offs[0].start;
-	offs_end = rx->offs[0].end;
-#else /* PERL_VERSION */
-	offs_beg = rx->startp[0];
-	offs_end = rx->endp[0];
-#endif
-	str->str += utf8_length((U8 *)str_beg, (U8 *)(str_beg + offs_beg));
-	str->len = utf8_length((U8 *)(str_beg + offs_beg),
-			       (U8 *)(str_beg + offs_end));
-    } else
-	str->str = NULL;
+    for (i = 0; i < obj->mapsiz; i++) {
+	q = eaw ? obj->map[i].eaw : obj->map[i].lbc;
+	if (q == PROP_UNKNOWN)
+	    continue;
+	if (p != q) {
+	    if (ranges && codes != NULL) {
+		av = newAV();
+		av_push(av, newSVuv(beg));
+		av_push(av, newSVuv(end));
+		av_push(codes, newRV_noinc((SV *)av));
+	    }
+	    p = q;
+	    codes = newAV();
+	    av = newAV();
+	    av_push(av, newRV_noinc((SV *)codes));
+	    av_push(av, newSViv((IV)p));
+	    if (ret == NULL)
+		ret = newAV();
+	    av_push(ret, newRV_noinc((SV *)av));
+	} else if (ranges && end + 1 == obj->map[i].beg) {
+	    end = obj->map[i].end;
+	    continue;
+	} else if (ranges) {
+	    av = newAV();
+	    av_push(av, newSVuv(beg));
+	    av_push(av, newSVuv(end));
+	    av_push(codes, newRV_noinc((SV *)av));
+	}
+	if (ranges) {
+	    beg = obj->map[i].beg;
+	    end = obj->map[i].end;
+	} else
+	    for (c = obj->map[i].beg; c <= obj->map[i].end; c++)
+		av_push(codes, newSVuv(c));
+    }
+    if (ranges && codes != NULL) {
+	av = newAV();
+	av_push(av, newSVuv(beg));
+	av_push(av, newSVuv(end));
+	av_push(codes, newRV_noinc((SV *)av));
+    }
 
-    SvREFCNT_dec(screamer);
+    if (ret == NULL)
+	return NULL;
+    return newRV_noinc((SV *)ret);
 }
 
-/***
- *** Callbacks for Sombok library.
- ***/
+static void lbobj_unshare(linebreak_t *);
 
 /*
- * Increment/decrement reference count
+ * Set property of characters BEG..END in tailoring map to P: eaw field if
+ * EAW is true, otherwise lbc field.  Entries overlapping the range are
+ * split and gaps are filled by new entries, so that the map is kept
+ * sorted without overlaps by one pass regardless of size of the range.
+ * Map shared with other objects is made private first.
  */
-void ref_func(void *sv, int datatype, int d)
+static
+void map_update_range(linebreak_t *obj, unichar_t beg, unichar_t end,
+		      propval_t p, int eaw)
 {
-    if (sv == NULL)
+    mapent_t *map, *m, ent, prev, blank;
+    size_t i, n = 0;
+    unichar_t cur = beg;
+    int done = 0;
+
+    if (end < beg)
 	return;
-    if (0 < d)
-	SvREFCNT_inc((SV *)sv);
-    else if (d < 0)
-	SvREFCNT_dec((SV *)sv);
+    lbobj_unshare(obj);
+    if ((map = malloc(sizeof(mapent_t) * (obj->mapsiz * 2 + 3))) == NULL)
+	croak("_config: %s", strerror(errno));
+    memset(&blank, 0xFF, sizeof(mapent_t)); /* all properties unknown */
+
+/* Append entry B..E with properties of SRC, merging adjacent one. */
+#define MAP_PUSH(b, e, src) \
+    do { \
+	ent = (src); \
+	ent.beg = (b); \
+	ent.end = (e); \
+	if (0 < n && map[n - 1].end + 1 == ent.beg) { \
+	    prev = map[n - 1]; \
+	    prev.beg = ent.beg; \
+	    prev.end = ent.end; \
+	} \
+	if (0 < n && map[n - 1].end + 1 == ent.beg && \
+	    memcmp(&prev, &ent, sizeof(mapent_t)) == 0) \
+	    map[n - 1].end = ent.end; \
+	else \
+	    map[n++] = ent; \
+    } while (0)
+/* Same but property is overridden by P. */
+#define MAP_PUSH_P(b, e, src) \
+    do { \
+	mapent_t tmp = (src); \
+	if (eaw) \
+	    tmp.eaw = p; \
+	else \
+	    tmp.lbc = p; \
+	MAP_PUSH((b), (e), tmp); \
+    } while (0)
+
+    for (i = 0; i < obj->mapsiz; i++) {
+	m = obj->map + i;
+	if (done || m->end < beg)
+	    MAP_PUSH(m->beg, m->end, *m);
+	else if (end < m->beg) {
+	    MAP_PUSH_P(cur, end, blank);
+	    done = 1;
+	    MAP_PUSH(m->beg, m->end, *m);
+	} else {
+	    /* Entry overlapping the range. */
+	    if (m->beg < beg)
+		MAP_PUSH(m->beg, beg - 1, *m);
+	    else if (cur < m->beg)
+		MAP_PUSH_P(cur, m->beg - 1, blank);
+	    if (end <= m->end) {
+		MAP_PUSH_P((m->beg < beg) ? beg : m->beg, end, *m);
+		if (end < m->end)
+		    MAP_PUSH(end + 1, m->end, *m);
+		done = 1;
+	    } else {
+		MAP_PUSH_P((m->beg < beg) ? beg : m->beg, m->end, *m);
+		cur = m->end + 1;
+	    }
+	}
+    }
+    if (!done)
+	MAP_PUSH_P(cur, end, blank);
+
+#undef MAP_PUSH_P
+#undef MAP_PUSH
+
+    if ((m = realloc(map, sizeof(mapent_t) * n)) != NULL)
+	map = m;
+    free(obj->map);
+    obj->map = map;
+    obj->mapsiz = n;
 }
 
 /*
- * Call preprocessing function
+ * Update tailoring map by Perl argument [ORD => PROP].
+ * ORD is an integer or array reference of integers and/or ranges [BEG, END].
+ * PROP is stored into eaw field if EAW is true, otherwise lbc field.
  */
 static
-gcstring_t *prep_func(linebreak_t *lbobj, void *dataref, unistr_t *str,
-		      unistr_t *text)
+void SVtomap(linebreak_t *obj, SV *val, int eaw)
 {
-    AV *data;
-    SV *sv, **pp, *func = NULL;
-    REGEXP *rx = NULL;
-    size_t count, i, j;
-    gcstring_t *gcstr, *ret;
-
-    if (dataref == NULL ||
-	(data = (AV *)SvRV((SV *)dataref)) == NULL)
-	return (lbobj->errnum = EINVAL), NULL;
+    AV *av, *codes, *range;
+    SV *sv, *beg, *end;
+    propval_t p;
+    size_t i;
 
-    /* Pass I */
+    if (!SvROK(val) || SvTYPE(av = (AV *)SvRV(val)) != SVt_PVAV ||
+	av_len(av) + 1 != 2 ||
+	av_fetch(av, 0, 0) == NULL || av_fetch(av, 1, 0) == NULL)
+	croak("_config: Invalid argument");
 
-    if (text != NULL) {
-	if ((pp = av_fetch(data, 0, 0)) == NULL)
-	    return (lbobj->errnum = EINVAL), NULL;
+    sv = *av_fetch(av, 1, 0);
+    if (SvIOK(sv))
+	p = (propval_t) SvIV(sv);
+    else
+	croak("_config: Invalid argument");
 
-#if ((PERL_VERSION >= 10) || (PERL_VERSION >= 9 && PERL_SUBVERSION >= 5))
-	if (SvRXOK(*pp))
-	    rx = SvRX(*pp);
-#else /* PERL_VERSION */
-	if (SvROK(*pp) && SvMAGICAL(sv = SvRV(*pp))) {
-	    MAGIC *mg;
-	    if ((mg = mg_find(sv, PERL_MAGIC_qr)) != NULL)
-		rx = (REGEXP *)mg->mg_obj;
+    sv = *av_fetch(av, 0, 0);
+    if (SvROK(sv) && SvTYPE(codes = (AV *)SvRV(sv)) == SVt_PVAV) {
+	for (i = 0; i < av_len(codes) + 1; i++) {
+	    if (av_fetch(codes, i, 0) == NULL)
+		continue;
+	    sv = *av_fetch(codes, i, 0);
+	    if (SvIOK(sv))
+		map_update_range(obj, (unichar_t) SvUV(sv),
+				 (unichar_t) SvUV(sv), p, eaw);
+	    else if (SvROK(sv) &&
+		     SvTYPE(range = (AV *)SvRV(sv)) == SVt_PVAV &&
+		     av_len(range) + 1 == 2 &&
+		     av_fetch(range, 0, 0) != NULL &&
+		     av_fetch(range, 1, 0) != NULL &&
+		     SvIOK(beg = *av_fetch(range, 0, 0)) &&
+		     SvIOK(end = *av_fetch(range, 1, 0)))
+		map_update_range(obj, (unichar_t) SvUV(beg),
+				 (unichar_t) SvUV(end), p, eaw);
+	    else
+		croak("_config: Invalid argument");
 	}
-#endif /* PERL_VERSION */
-	if (rx == NULL)
-	    return (lbobj->errnum = EINVAL), NULL;
+    } else if (SvIOK(sv))
+	map_update_range(obj, (unichar_t) SvUV(sv), (unichar_t) SvUV(sv),
+			 p, eaw);
+    else
+	croak("_config: Invalid argument");
+}
 
-	do_pregexec_once(rx, str);
-	return NULL;
-    }
+/***
+ *** Shared buffers.
+ ***/
 
-    /* Pass II */
+/*
+ * Options private to this module.  These are kept in high bits of
+ * options member so that they are copied along with other options.
+ */
+#define LINEBREAK_OPTION_FROZEN (1U << 30)
+#define LINEBREAK_OPTION_OPTIMAL_LAYOUT (1U << 29)
 
-    if ((pp = av_fetch(data, 1, 0)) == NULL)
-        func = NULL;
-    else if (SvOK(*pp))
-        func = *pp;
-    else
-        func = NULL;
+/*
+ * Registry of buffers shared by several objects, e.g. tailoring map
+ * shared by a frozen profile and its clones.  A buffer not registered
+ * here is owned by just one object.  A buffer mapped from file is
+ * registered along with its mapping, and is unmapped by the last holder.
+ */
+typedef struct sharedbuf_t {
+    void *ptr;
+    size_t refcount;
+    void *mapbase;
+    size_t maplen;
+    struct sharedbuf_t *next;
+} sharedbuf_t;
+
+#define SHAREDBUF_BUCKETS (61)
+#define SHAREDBUF_HASH(p) ((size_t)(PTR2UV(p) >> 3) % SHAREDBUF_BUCKETS)
+
+static sharedbuf_t *sharedbuf_tab[SHAREDBUF_BUCKETS];
+#ifdef USE_ITHREADS
+static perl_mutex sharedbuf_mutex;
+static int sharedbuf_mutex_initialized = 0;
+#  define SHAREDBUF_LOCK MUTEX_LOCK(&sharedbuf_mutex)
+#  define SHAREDBUF_UNLOCK MUTEX_UNLOCK(&sharedbuf_mutex)
+#else
+#  define SHAREDBUF_LOCK NOOP
+#  define SHAREDBUF_UNLOCK NOOP
+#endif /* USE_ITHREADS */
 
-    if (func == NULL) {
-	if ((ret = gcstring_newcopy(str, lbobj)) == NULL)
-	    return (lbobj->errnum = errno ? errno : ENOMEM), NULL;
-    } else {
-	dSP;
-	ENTER;
-	SAVETMPS;
-	PUSHMARK(SP);
-	linebreak_incref(lbobj); /* mortal but should not be destroyed.*/
-	XPUSHs(sv_2mortal(CtoPerl("Unicode::LineBreak", lbobj)));
-	XPUSHs(sv_2mortal(unistrtoSV(str, 0, str->len)));
-	PUTBACK;
-	count = call_sv(func, G_ARRAY | G_EVAL);
+static
+sharedbuf_t **sharedbuf_find(void *ptr)
+{
+    sharedbuf_t **p;
 
-	SPAGAIN;
-	if (SvTRUE(ERRSV)) {
-	    if (!lbobj->errnum)
-		 lbobj->errnum = LINEBREAK_EEXTN;
-	    return NULL;
-	}
+    for (p = &sharedbuf_tab[SHAREDBUF_HASH(ptr)]; *p != NULL;
+	 p = &(*p)->next)
+	if ((*p)->ptr == ptr)
+	    break;
+    return p;
+}
 
-	if ((ret = gcstring_new(NULL, lbobj)) == NULL)
-	    return (lbobj->errnum = errno ? errno : ENOMEM), NULL;
+/*
+ * Add a holder of buffer.  Buffer is registered when it is shared first.
+ */
+static
+void sharedbuf_inc(void *ptr)
+{
+    sharedbuf_t **p, *ent;
 
-	for (i = 0; i < count; i++) {
-	    sv = POPs;
-	    if (!SvOK(sv))
-		continue;
-	    gcstr = SVtogcstring(sv, lbobj);
+    SHAREDBUF_LOCK;
+    if (*(p = sharedbuf_find(ptr)) != NULL) {
+	(*p)->refcount++;
+	SHAREDBUF_UNLOCK;
+	return;
+    }
+    SHAREDBUF_UNLOCK;
+
+    if ((ent = malloc(sizeof(sharedbuf_t))) == NULL)
+	croak("sharedbuf_inc: %s", strerror(errno));
+    SHAREDBUF_LOCK;
+    if (*(p = sharedbuf_find(ptr)) != NULL) {
+	(*p)->refcount++;
+	SHAREDBUF_UNLOCK;
+	free(ent);
+    } else {
+	ent->ptr = ptr;
+	ent->refcount = 2;
+	ent->mapbase = NULL;
+	ent->maplen = 0;
+	ent->next = NULL;
+	*p = ent;
+	SHAREDBUF_UNLOCK;
+    }
+}
 
-	    for (j = 0; j < gcstr->gclen; j++) {
-		if (gcstr->gcstr[j].flag &
-		    (LINEBREAK_FLAG_ALLOW_BEFORE |
-		     LINEBREAK_FLAG_PROHIBIT_BEFORE))
-		    continue;
-		if (i < count - 1 && j == 0)
-		    gcstr->gcstr[j].flag |= LINEBREAK_FLAG_ALLOW_BEFORE;
-		else if (0 < j)
-		    gcstr->gcstr[j].flag |= LINEBREAK_FLAG_PROHIBIT_BEFORE;
-	    }
+/*
+ * Register buffer mapped from file.  The caller is the only holder.
+ */
+static
+void sharedbuf_map(void *ptr, void *mapbase, size_t maplen)
+{
+    sharedbuf_t **p, *ent;
+
+    if ((ent = malloc(sizeof(sharedbuf_t))) == NULL)
+	croak("sharedbuf_map: %s", strerror(errno));
+    ent->ptr = ptr;
+    ent->refcount = 1;
+    ent->mapbase = mapbase;
+    ent->maplen = maplen;
+    SHAREDBUF_LOCK;
+    p = sharedbuf_find(ptr);
+    ent->next = *p;
+    *p = ent;
+    SHAREDBUF_UNLOCK;
+}
 
-	    gcstring_replace(ret, 0, 0, gcstr);
-	    if (!sv_isobject(sv))
-		gcstring_destroy(gcstr);
-	}
+/*
+ * Remove a holder of buffer.  Returns false if the caller owns the buffer
+ * and should free it by itself, otherwise true.
+ */
+static
+int sharedbuf_dec(void *ptr)
+{
+    sharedbuf_t **p, *ent;
 
-	PUTBACK;
-	FREETMPS;
-	LEAVE;
+    SHAREDBUF_LOCK;
+    if ((ent = *(p = sharedbuf_find(ptr))) == NULL) {
+	SHAREDBUF_UNLOCK;
+	return 0;
+    }
+    /* The last one of other holders will own malloc()'ed buffer. */
+    if (--ent->refcount == (ent->mapbase == NULL ? 1 : 0))
+	*p = ent->next;
+    else
+	ent = NULL;
+    SHAREDBUF_UNLOCK;
+    if (ent != NULL) {
+#ifdef HAS_MMAP
+	if (ent->mapbase != NULL)
+	    munmap(ent->mapbase, ent->maplen);
+#endif /* HAS_MMAP */
+	free(ent);
     }
+    return 1;
+}
+
+static
+int sharedbuf_isshared(void *ptr)
+{
+    int ret;
 
+    SHAREDBUF_LOCK;
+    ret = (*sharedbuf_find(ptr) != NULL);
+    SHAREDBUF_UNLOCK;
     return ret;
 }
 
 /*
- * Call format function
+ * Copy linebreak object sharing its tailoring map.
  */
 static
-char *linebreak_states[] = {
-    NULL, "sot", "sop", "sol", "", "eol", "eop", "eot", NULL
-};
-static
-gcstring_t *format_func(linebreak_t *lbobj, linebreak_state_t action,
-			gcstring_t *str)
+linebreak_t *lbobj_share(linebreak_t *obj)
 {
-    SV *sv;
-    char *actionstr;
-    int count;
-    gcstring_t *ret;
+    linebreak_t *ret;
+    mapent_t *map = obj->map;
+    size_t mapsiz = obj->mapsiz;
+
+    if (map == NULL || mapsiz == 0)
+	return linebreak_copy(obj);
+
+    obj->map = NULL;
+    obj->mapsiz = 0;
+    ret = linebreak_copy(obj);
+    obj->map = map;
+    obj->mapsiz = mapsiz;
+    if (ret == NULL)
+	return NULL;
+
+    sharedbuf_inc(map);
+    ret->map = map;
+    ret->mapsiz = mapsiz;
+    return ret;
+}
+
+/*
+ * Make tailoring map private before it is modified.
+ */
+static
+void lbobj_unshare(linebreak_t *obj)
+{
+    mapent_t *map;
+
+    if (obj->map == NULL || !sharedbuf_isshared(obj->map))
+	return;
+    if ((map = malloc(sizeof(mapent_t) * obj->mapsiz)) == NULL)
+	croak("lbobj_unshare: %s", strerror(errno));
+    memcpy(map, obj->map, sizeof(mapent_t) * obj->mapsiz);
+    if (!sharedbuf_dec(obj->map))
+	free(obj->map); /* the others have gone in the meantime. */
+    obj->map = map;
+}
+
+/*
+ * Detach shared tailoring map from linebreak object about to be destroyed
+ * so that it would not be freed by linebreak_destroy().
+ */
+static
+void lbobj_detach(linebreak_t *obj)
+{
+    if (obj == NULL || obj->refcount != 1 || obj->map == NULL)
+	return;
+    if (sharedbuf_dec(obj->map)) {
+	obj->map = NULL;
+	obj->mapsiz = 0;
+    }
+}
+
+/*
+ * Release linebreak object.  Shared tailoring map is detached before the
+ * last reference is destroyed.
+ */
+static
+void lbobj_destroy(linebreak_t *obj)
+{
+    lbobj_detach(obj);
+    linebreak_destroy(obj);
+}
+
+/*
+ * Slices of grapheme cluster string share Unicode buffer with the string
+ * they were taken from.  Since a slice points into middle of the buffer,
+ * start of the buffer is kept by magic of inner SV of each holder.
+ * Clusters are not shared so that their flags may be modified freely.
+ * Short substrings are merely copied, as they would cost less than
+ * keeping track of buffer.
+ */
+#define GCSTRING_SLICE_MIN (256)
+
+#ifdef USE_ITHREADS
+static
+int gcstring_slice_svt_dup(pTHX_ MAGIC *mg, CLONE_PARAMS *param)
+{
+    mg->mg_ptr = NULL; /* clone has its own copy: see gcstring_dup(). */
+    return 0;
+}
+
+static MGVTBL gcstring_slice_vtbl = {
+    NULL, NULL, NULL, NULL, NULL, NULL, gcstring_slice_svt_dup, NULL
+};
+#else /* USE_ITHREADS */
+static MGVTBL gcstring_slice_vtbl = {
+    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+};
+#endif /* USE_ITHREADS */
+
+/*
+ * Find magic of inner SV of Perl object.  It is attached if CREATE is
+ * true.
+ */
+static
+MAGIC *gcstring_magic(pTHX_ SV *sv, MGVTBL *vtbl, int create)
+{
+    MAGIC *mg;
+
+    if (SvMAGICAL(sv))
+	for (mg = SvMAGIC(sv); mg != NULL; mg = mg->mg_moremagic)
+	    if (mg->mg_type == PERL_MAGIC_ext && mg->mg_virtual == vtbl)
+		return mg;
+    if (!create)
+	return NULL;
+    mg = sv_magicext(sv, NULL, PERL_MAGIC_ext, vtbl, NULL, 0);
+#ifdef USE_ITHREADS
+    mg->mg_flags |= MGf_DUP;
+#endif /* USE_ITHREADS */
+    return mg;
+}
+
+/*
+ * Substring of Perl object SV as a slice.
+ */
+static
+SV *gcstring_slice(pTHX_ SV *sv, int offset, int length, char *func)
+{
+    gcstring_t *gcstr = PerltoC(gcstring_t *, sv), *ret;
+    MAGIC *mg;
+    void *base;
+    size_t beg, end, i;
+    SV *retsv;
+    int o = offset, l = length;
+
+    if (o < 0)
+	o += gcstr->gclen;
+    if (l < 0)
+	l += gcstr->gclen - o;
+    if (0 <= o && (size_t)o < gcstr->gclen && 0 < l) {
+	if (gcstr->gclen - o < (size_t)l)
+	    l = gcstr->gclen - o;
+	beg = gcstr->gcstr[o].idx;
+	end = (o + l < gcstr->gclen) ? gcstr->gcstr[o + l].idx : gcstr->len;
+    } else
+	beg = end = 0;
+    if (end - beg < GCSTRING_SLICE_MIN) {
+	if ((ret = gcstring_substr(gcstr, offset, length)) == NULL)
+	    croak("%s: %s", func, strerror(errno));
+	return CtoPerl("Unicode::GCString", ret);
+    }
+
+    mg = gcstring_magic(aTHX_ SvRV(sv), &gcstring_slice_vtbl, 1);
+    if (mg->mg_ptr == NULL)
+	mg->mg_ptr = (char *)gcstr->str;
+    base = mg->mg_ptr;
+
+    if ((ret = gcstring_new(NULL, gcstr->lbobj)) == NULL ||
+	(ret->gcstr = malloc(sizeof(gcchar_t) * l)) == NULL)
+	croak("%s: %s", func, strerror(errno));
+    ret->str = gcstr->str + beg;
+    ret->len = end - beg;
+    for (i = 0; i < (size_t)l; i++) {
+	ret->gcstr[i] = gcstr->gcstr[o + i];
+	ret->gcstr[i].idx -= beg;
+    }
+    ret->gclen = l;
+
+    sharedbuf_inc(base);
+    retsv = CtoPerl("Unicode::GCString", ret);
+    gcstring_magic(aTHX_ SvRV(retsv), &gcstring_slice_vtbl, 1)->mg_ptr =
+	(char *)base;
+    return retsv;
+}
+
+/*
+ * Make Unicode buffer private before it is modified.  SV is inner SV of
+ * Perl object.
+ */
+static
+void gcstring_unshare(pTHX_ SV *sv, gcstring_t *gcstr)
+{
+    MAGIC *mg;
+    void *base;
+    unichar_t *str = NULL;
+
+    if ((mg = gcstring_magic(aTHX_ sv, &gcstring_slice_vtbl, 0)) == NULL ||
+	(base = mg->mg_ptr) == NULL)
+	return;
+    mg->mg_ptr = NULL;
+    if (base == (void *)gcstr->str && !sharedbuf_isshared(base))
+	return;
+    if (gcstr->len != 0) {
+	if ((str = malloc(sizeof(unichar_t) * gcstr->len)) == NULL)
+	    croak("gcstring_unshare: %s", strerror(errno));
+	memcpy(str, gcstr->str, sizeof(unichar_t) * gcstr->len);
+    }
+    if (!sharedbuf_dec(base))
+	free(base); /* the others have gone in the meantime. */
+    gcstr->str = str;
+}
+
+/*
+ * Detach shared Unicode buffer from grapheme cluster string about to be
+ * destroyed so that it would not be freed by gcstring_destroy().
+ */
+static
+void gcstring_detach(pTHX_ SV *sv, gcstring_t *gcstr)
+{
+    MAGIC *mg;
+    void *base;
+
+    if (gcstr == NULL ||
+	(mg = gcstring_magic(aTHX_ sv, &gcstring_slice_vtbl, 0)) == NULL ||
+	(base = mg->mg_ptr) == NULL)
+	return;
+    mg->mg_ptr = NULL;
+    if (sharedbuf_dec(base))
+	gcstr->str = NULL;
+    else if (base != (void *)gcstr->str) {
+	free(base); /* the last holder is a slice. */
+	gcstr->str = NULL;
+    }
+}
+
+/*
+ * Grapheme cluster string appended to by ".=" operator keeps allocated
+ * sizes of its buffers by magic, so that the buffers may grow
+ * geometrically.  Sizes are valid only while the buffers are those
+ * recorded; they are reset by other operations modifying buffers.
+ */
+typedef struct {
+    unichar_t *str;
+    size_t len;
+    size_t strsiz;
+    gcchar_t *gcstr;
+    size_t gclen;
+    size_t gcsiz;
+} gcstring_capa_t;
+
+static
+int gcstring_capa_svt_free(pTHX_ SV *sv, MAGIC *mg)
+{
+    free(mg->mg_ptr);
+    mg->mg_ptr = NULL;
+    return 0;
+}
+
+#ifdef USE_ITHREADS
+static
+int gcstring_capa_svt_dup(pTHX_ MAGIC *mg, CLONE_PARAMS *param)
+{
+    mg->mg_ptr = NULL; /* buffers of clone are not extended. */
+    return 0;
+}
+#endif /* USE_ITHREADS */
+
+static MGVTBL gcstring_capa_vtbl = {
+    NULL, NULL, NULL, NULL, gcstring_capa_svt_free, NULL,
+#ifdef USE_ITHREADS
+    gcstring_capa_svt_dup,
+#else /* USE_ITHREADS */
+    NULL,
+#endif /* USE_ITHREADS */
+    NULL
+};
+
+static
+void gcstring_capa_reset(pTHX_ SV *sv)
+{
+    MAGIC *mg;
+
+    if ((mg = gcstring_magic(aTHX_ sv, &gcstring_capa_vtbl, 0)) != NULL) {
+	free(mg->mg_ptr);
+	mg->mg_ptr = NULL;
+    }
+}
+
+/*
+ * UTF-8 string converted from grapheme cluster string is cached by magic
+ * so that repeated stringification may merely copy it (or share buffer
+ * copy-on-write).  Cache is dropped by operations modifying text.
+ */
+static
+int gcstring_utf8_svt_free(pTHX_ SV *sv, MAGIC *mg)
+{
+    SvREFCNT_dec((SV *)mg->mg_ptr);
+    mg->mg_ptr = NULL;
+    return 0;
+}
+
+#ifdef USE_ITHREADS
+static
+int gcstring_utf8_svt_dup(pTHX_ MAGIC *mg, CLONE_PARAMS *param)
+{
+    mg->mg_ptr = NULL; /* clone makes its own cache. */
+    return 0;
+}
+#endif /* USE_ITHREADS */
+
+static MGVTBL gcstring_utf8_vtbl = {
+    NULL, NULL, NULL, NULL, gcstring_utf8_svt_free, NULL,
+#ifdef USE_ITHREADS
+    gcstring_utf8_svt_dup,
+#else /* USE_ITHREADS */
+    NULL,
+#endif /* USE_ITHREADS */
+    NULL
+};
+
+static
+SV *gcstring_utf8(pTHX_ SV *sv, gcstring_t *gcstr)
+{
+    MAGIC *mg;
+
+    mg = gcstring_magic(aTHX_ sv, &gcstring_utf8_vtbl, 1);
+    if (mg->mg_ptr == NULL)
+	mg->mg_ptr = (char *)unistrtoSV((unistr_t *)gcstr, 0, gcstr->len);
+    return newSVsv((SV *)mg->mg_ptr);
+}
+
+static
+void gcstring_utf8_reset(pTHX_ SV *sv)
+{
+    MAGIC *mg;
+
+    if ((mg = gcstring_magic(aTHX_ sv, &gcstring_utf8_vtbl, 0)) != NULL) {
+	SvREFCNT_dec((SV *)mg->mg_ptr);
+	mg->mg_ptr = NULL;
+    }
+}
+
+/*
+ * Compare Unicode strings by code points.  Equal blocks are skipped by
+ * memcmp().
+ */
+#define UNISTR_CMP_BLOCK (32)
+
+static
+int unistr_cmp(unistr_t *a, unistr_t *b)
+{
+    size_t len = (a->len < b->len) ? a->len : b->len, i = 0;
+
+    for (; i + UNISTR_CMP_BLOCK <= len; i += UNISTR_CMP_BLOCK)
+	if (memcmp(a->str + i, b->str + i,
+		   sizeof(unichar_t) * UNISTR_CMP_BLOCK) != 0)
+	    break;
+    for (; i < len; i++)
+	if (a->str[i] != b->str[i])
+	    return (a->str[i] < b->str[i]) ? -1 : 1;
+    return (a->len < b->len) ? -1 : (b->len < a->len) ? 1 : 0;
+}
+
+/*
+ * Compare grapheme cluster string with Perl string STR without making
+ * clusters of the latter.  Since order of UTF-8 bytes is that of code
+ * points, cached UTF-8 string is compared bytewise if any.  SV is inner SV
+ * of Perl object.
+ */
+static
+int gcstring_cmp_sv(pTHX_ SV *sv, gcstring_t *gcstr, SV *str)
+{
+    MAGIC *mg;
+    SV *utf8sv;
+    U8 *s, *end, *u;
+    STRLEN len, ulen, clen;
+    size_t i;
+    unichar_t c;
+    int r;
+
+    if (!SvOK(str))
+	return gcstr->len ? 1 : 0;
+    s = (U8 *)SvPV(str, len);
+    end = s + len;
+
+    if ((mg = gcstring_magic(aTHX_ sv, &gcstring_utf8_vtbl, 0)) != NULL &&
+	(utf8sv = (SV *)mg->mg_ptr) != NULL &&
+	(SvUTF8(str) || ascii_span(s, len) == len)) {
+	u = (U8 *)SvPV(utf8sv, ulen);
+	if ((r = memcmp(u, s, (ulen < len) ? ulen : len)) != 0)
+	    return (r < 0) ? -1 : 1;
+	return (ulen < len) ? -1 : (len < ulen) ? 1 : 0;
+    }
+
+    for (i = 0; i < gcstr->len && s < end; i++) {
+	if (*s < 0x80)
+	    c = (unichar_t)*s++;
+	else {
+	    c = utf8_decode_char(s, end, &clen);
+	    if (clen == 0)
+		croak("cmp: Not well-formed UTF-8");
+	    s += clen;
+	}
+	if (gcstr->str[i] != c)
+	    return (gcstr->str[i] < c) ? -1 : 1;
+    }
+    return (i < gcstr->len) ? 1 : (s < end) ? -1 : 0;
+}
+
+/*
+ * Sort items of array by code points, without making clusters of Perl
+ * strings.  Sorting is stable.
+ */
+typedef struct {
+    unistr_t key;
+    SV *sv;
+    size_t idx;
+} gcstring_sortent_t;
+
+static
+int gcstring_sortent_cmp(const void *a, const void *b)
+{
+    gcstring_sortent_t *x = (gcstring_sortent_t *)a;
+    gcstring_sortent_t *y = (gcstring_sortent_t *)b;
+    int r;
+
+    if ((r = unistr_cmp(&x->key, &y->key)) != 0)
+	return r;
+    return (x->idx < y->idx) ? -1 : (y->idx < x->idx) ? 1 : 0;
+}
+
+static
+void gcstring_sortent_free(void *ptr)
+{
+    free(ptr);
+}
+
+static
+void gcstring_sort(pTHX_ AV *av)
+{
+    gcstring_sortent_t *ents;
+    SSize_t n = av_len(av) + 1, i;
+    SV **svp, *sv;
+
+    if (n < 2)
+	return;
+    ENTER;
+    if ((ents = malloc(sizeof(gcstring_sortent_t) * n)) == NULL)
+	croak("sort: %s", strerror(errno));
+    memset(ents, 0, sizeof(gcstring_sortent_t) * n);
+    SAVEDESTRUCTOR(gcstring_sortent_free, ents);
+    for (i = 0; i < n; i++) {
+	sv = ((svp = av_fetch(av, i, 0)) == NULL) ? &PL_sv_undef : *svp;
+	ents[i].sv = sv;
+	ents[i].idx = i;
+	if (sv_isobject(sv) && sv_derived_from(sv, "Unicode::GCString"))
+	    ents[i].key = *(unistr_t *)PerltoC(gcstring_t *, sv);
+	else if (sv_isobject(sv))
+	    croak("sort: Unknown object %s", HvNAME(SvSTASH(SvRV(sv))));
+	else {
+	    SVtounistr(&ents[i].key, sv);
+	    SAVEDESTRUCTOR(gcstring_sortent_free, ents[i].key.str);
+	}
+    }
+    qsort(ents, n, sizeof(gcstring_sortent_t), gcstring_sortent_cmp);
+    /* Holes get fresh undefined values, not the read-only PL_sv_undef. */
+    for (i = 0; i < n; i++)
+	ents[i].sv = (ents[i].sv == &PL_sv_undef) ?
+	    newSV(0) : SvREFCNT_inc(ents[i].sv);
+    for (i = 0; i < n; i++)
+	if (av_store(av, i, ents[i].sv) == NULL)
+	    SvREFCNT_dec(ents[i].sv);
+    LEAVE;
+}
+
+/*
+ * Normalize OFFSET and LENGTH of substring of string with GCLEN clusters
+ * in the same way as gcstring_substr() does.
+ */
+static
+void gcstring_range(size_t gclen, int *offset, int *length)
+{
+    if (*offset < 0)
+	*offset += gclen;
+    if (*offset < 0)
+	*offset = 0;
+    else if (gclen < (size_t)*offset)
+	*offset = gclen;
+    if (*length < 0)
+	*length += gclen - *offset;
+    if (*length < 0)
+	*length = 0;
+    else if (gclen < (size_t)(*offset + *length))
+	*length = gclen - *offset;
+}
+
+/*
+ * Long grapheme cluster string keeps prefix sums of columns by magic:
+ * sums[i] is number of columns of the first i clusters.  Sums are
+ * computed lazily, and those before modified clusters are kept.
+ */
+#define GCSTRING_COLUMNS_MIN (32)
+
+typedef struct {
+    size_t *sums;
+    size_t len;		/* number of valid sums */
+    size_t siz;
+} gcstring_cols_t;
+
+static
+int gcstring_cols_svt_free(pTHX_ SV *sv, MAGIC *mg)
+{
+    gcstring_cols_t *cols = (gcstring_cols_t *)mg->mg_ptr;
+
+    if (cols != NULL)
+	free(cols->sums);
+    free(cols);
+    mg->mg_ptr = NULL;
+    return 0;
+}
+
+#ifdef USE_ITHREADS
+static
+int gcstring_cols_svt_dup(pTHX_ MAGIC *mg, CLONE_PARAMS *param)
+{
+    mg->mg_ptr = NULL; /* clone computes its own sums. */
+    return 0;
+}
+#endif /* USE_ITHREADS */
+
+static MGVTBL gcstring_cols_vtbl = {
+    NULL, NULL, NULL, NULL, gcstring_cols_svt_free, NULL,
+#ifdef USE_ITHREADS
+    gcstring_cols_svt_dup,
+#else /* USE_ITHREADS */
+    NULL,
+#endif /* USE_ITHREADS */
+    NULL
+};
+
+/*
+ * Number of columns of clusters OFFSET..OFFSET+LENGTH, which should have
+ * been normalized.
+ */
+static
+size_t gcstring_colsum(pTHX_ SV *sv, gcstring_t *gcstr, size_t offset,
+		       size_t length)
+{
+    MAGIC *mg;
+    gcstring_cols_t *cols;
+    size_t end = offset + length, siz, i, ret;
+
+    if (gcstr->gclen < GCSTRING_COLUMNS_MIN) {
+	for (i = offset, ret = 0; i < end; i++)
+	    ret += gcstr->gcstr[i].col;
+	return ret;
+    }
+
+    mg = gcstring_magic(aTHX_ sv, &gcstring_cols_vtbl, 1);
+    if ((cols = (gcstring_cols_t *)mg->mg_ptr) == NULL) {
+	if ((cols = malloc(sizeof(gcstring_cols_t))) == NULL)
+	    croak("columns: %s", strerror(errno));
+	cols->sums = NULL;
+	cols->len = cols->siz = 0;
+	mg->mg_ptr = (char *)cols;
+    }
+    if (cols->siz < gcstr->gclen + 1) {
+	for (siz = cols->siz ? cols->siz : 64; siz < gcstr->gclen + 1; )
+	    siz *= 2;
+	if ((cols->sums = realloc(cols->sums, sizeof(size_t) * siz)) == NULL)
+	    croak("columns: %s", strerror(errno));
+	cols->siz = siz;
+    }
+    if (cols->len == 0) {
+	cols->sums[0] = 0;
+	cols->len = 1;
+    }
+    for (i = cols->len; i <= end; i++)
+	cols->sums[i] = cols->sums[i - 1] + gcstr->gcstr[i - 1].col;
+    if (cols->len < i)
+	cols->len = i;
+    return cols->sums[end] - cols->sums[offset];
+}
+
+/*
+ * Forget prefix sums of columns but those of the first N clusters.
+ */
+static
+void gcstring_cols_truncate(pTHX_ SV *sv, size_t n)
+{
+    MAGIC *mg;
+    gcstring_cols_t *cols;
+
+    if ((mg = gcstring_magic(aTHX_ sv, &gcstring_cols_vtbl, 0)) != NULL &&
+	(cols = (gcstring_cols_t *)mg->mg_ptr) != NULL && n + 1 < cols->len)
+	cols->len = n + 1;
+}
+
+/*
+ * Append STR to grapheme cluster string in place.  Clusters around the
+ * junction are made by the library, then the result is copied into
+ * growing buffers.  SV is inner SV of Perl object.
+ */
+static
+void gcstring_append_inplace(pTHX_ SV *sv, gcstring_t *gcstr,
+			     gcstring_t *str)
+{
+    MAGIC *mg;
+    gcstring_capa_t *capa;
+    gcstring_t *tail;
+    size_t idx, gcidx, len, gclen, siz, i;
+
+    if (str == NULL || str->len == 0)
+	return;
+    gcstring_unshare(aTHX_ sv, gcstr);
+    gcstring_utf8_reset(aTHX_ sv);
+
+    if (gcstr->gclen == 0)
+	tail = gcstring_new(NULL, gcstr->lbobj);
+    else
+	tail = gcstring_substr(gcstr, gcstr->gclen - 1, 1);
+    if (tail == NULL || gcstring_append(tail, str) == NULL)
+	croak("concat: %s", strerror(errno));
+    gcidx = gcstr->gclen ? gcstr->gclen - 1 : 0;
+    gcstring_cols_truncate(aTHX_ sv, gcidx);
+    idx = gcstr->gclen ? gcstr->gcstr[gcidx].idx : 0;
+    len = idx + tail->len;
+    gclen = gcidx + tail->gclen;
+
+    mg = gcstring_magic(aTHX_ sv, &gcstring_capa_vtbl, 1);
+    if ((capa = (gcstring_capa_t *)mg->mg_ptr) == NULL) {
+	if ((capa = malloc(sizeof(gcstring_capa_t))) == NULL)
+	    croak("concat: %s", strerror(errno));
+	mg->mg_ptr = (char *)capa;
+	memset(capa, 0, sizeof(gcstring_capa_t));
+    }
+    if (capa->str != gcstr->str || capa->len != gcstr->len) {
+	capa->str = gcstr->str;
+	capa->strsiz = gcstr->len;
+    }
+    if (capa->gcstr != gcstr->gcstr || capa->gclen != gcstr->gclen) {
+	capa->gcstr = gcstr->gcstr;
+	capa->gcsiz = gcstr->gclen;
+    }
+
+    if (capa->strsiz < len) {
+	for (siz = capa->strsiz ? capa->strsiz : 16; siz < len; )
+	    siz *= 2;
+	if ((capa->str = realloc(gcstr->str, sizeof(unichar_t) * siz)) ==
+	    NULL)
+	    croak("concat: %s", strerror(errno));
+	gcstr->str = capa->str;
+	capa->strsiz = siz;
+    }
+    if (capa->gcsiz < gclen) {
+	for (siz = capa->gcsiz ? capa->gcsiz : 16; siz < gclen; )
+	    siz *= 2;
+	if ((capa->gcstr = realloc(gcstr->gcstr, sizeof(gcchar_t) * siz)) ==
+	    NULL)
+	    croak("concat: %s", strerror(errno));
+	gcstr->gcstr = capa->gcstr;
+	capa->gcsiz = siz;
+    }
+
+    memcpy(gcstr->str + idx, tail->str, sizeof(unichar_t) * tail->len);
+    for (i = 0; i < tail->gclen; i++) {
+	gcstr->gcstr[gcidx + i] = tail->gcstr[i];
+	gcstr->gcstr[gcidx + i].idx += idx;
+    }
+    gcstr->len = capa->len = len;
+    gcstr->gclen = capa->gclen = gclen;
+    gcstring_destroy(tail);
+}
+
+/***
+ *** Editors of grapheme cluster strings.
+ ***/
+
+/*
+ * Editor keeps characters and clusters in gap buffers so that edits near
+ * the previous one would cost time proportional to the distance moved.
+ * Offsets of clusters after the gap are counted from the end of text, so
+ * that they would not change by edits before them.
+ */
+#define EDITOR_GCIDX(ed, i) \
+    (((i) < (ed)->gcgap) ? (ed)->gcstr[i].idx : \
+     ((ed)->gclen <= (i)) ? (ed)->len : \
+     (ed)->len - (ed)->gcstr[(i) + (ed)->gcsiz - (ed)->gclen].idx)
+
+static
+gceditor_t *editor_new(gcstring_t *gcstr)
+{
+    gceditor_t *ed;
+
+    if ((ed = malloc(sizeof(gceditor_t))) == NULL)
+	croak("editor: %s", strerror(errno));
+    ed->siz = gcstr->len + 64;
+    ed->gcsiz = gcstr->gclen + 64;
+    if ((ed->str = malloc(sizeof(unichar_t) * ed->siz)) == NULL ||
+	(ed->gcstr = malloc(sizeof(gcchar_t) * ed->gcsiz)) == NULL)
+	croak("editor: %s", strerror(errno));
+    if (gcstr->len)
+	memcpy(ed->str, gcstr->str, sizeof(unichar_t) * gcstr->len);
+    if (gcstr->gclen)
+	memcpy(ed->gcstr, gcstr->gcstr, sizeof(gcchar_t) * gcstr->gclen);
+    ed->len = ed->gap = gcstr->len;
+    ed->gclen = ed->gcgap = gcstr->gclen;
+    if ((ed->lbobj = gcstr->lbobj) != NULL)
+	linebreak_incref(ed->lbobj);
+    return ed;
+}
+
+static
+void editor_destroy(gceditor_t *ed)
+{
+    if (ed == NULL)
+	return;
+    free(ed->str);
+    free(ed->gcstr);
+    if (ed->lbobj != NULL) {
+	lbobj_destroy(ed->lbobj);
+    }
+    free(ed);
+}
+
+/*
+ * Copy of clusters OFFSET..OFFSET+LENGTH.
+ */
+static
+gcstring_t *editor_substr(gceditor_t *ed, size_t offset, size_t length)
+{
+    gcstring_t *ret;
+    size_t beg, end, n, i, j;
+
+    if ((ret = gcstring_new(NULL, ed->lbobj)) == NULL)
+	croak("substr: %s", strerror(errno));
+    if (length == 0)
+	return ret;
+    beg = EDITOR_GCIDX(ed, offset);
+    end = EDITOR_GCIDX(ed, offset + length);
+    if ((ret->str = malloc(sizeof(unichar_t) * (end - beg))) == NULL ||
+	(ret->gcstr = malloc(sizeof(gcchar_t) * length)) == NULL)
+	croak("substr: %s", strerror(errno));
+
+    if (beg < ed->gap) {
+	n = ((end < ed->gap) ? end : ed->gap) - beg;
+	memcpy(ret->str, ed->str + beg, sizeof(unichar_t) * n);
+    } else
+	n = 0;
+    if (ed->gap < end)
+	memcpy(ret->str + n, ed->str + ed->siz - ed->len + beg + n,
+	       sizeof(unichar_t) * (end - beg - n));
+    for (i = 0; i < length; i++) {
+	j = offset + i;
+	if (j < ed->gcgap)
+	    ret->gcstr[i] = ed->gcstr[j];
+	else
+	    ret->gcstr[i] = ed->gcstr[j + ed->gcsiz - ed->gclen];
+	ret->gcstr[i].idx = EDITOR_GCIDX(ed, j) - beg;
+    }
+    ret->len = end - beg;
+    ret->gclen = length;
+    return ret;
+}
+
+/*
+ * Move the gap to just before POS-th cluster.
+ */
+static
+void editor_move(gceditor_t *ed, size_t pos)
+{
+    size_t idx = EDITOR_GCIDX(ed, pos), i;
+    size_t gapsiz = ed->siz - ed->len, gcgapsiz = ed->gcsiz - ed->gclen;
+
+    if (pos < ed->gcgap) {
+	memmove(ed->str + idx + gapsiz, ed->str + idx,
+		sizeof(unichar_t) * (ed->gap - idx));
+	memmove(ed->gcstr + pos + gcgapsiz, ed->gcstr + pos,
+		sizeof(gcchar_t) * (ed->gcgap - pos));
+	for (i = pos; i < ed->gcgap; i++)
+	    ed->gcstr[i + gcgapsiz].idx = ed->len - ed->gcstr[i + gcgapsiz].idx;
+    } else if (ed->gcgap < pos) {
+	for (i = ed->gcgap; i < pos; i++)
+	    ed->gcstr[i + gcgapsiz].idx = ed->len - ed->gcstr[i + gcgapsiz].idx;
+	memmove(ed->str + ed->gap, ed->str + ed->gap + gapsiz,
+		sizeof(unichar_t) * (idx - ed->gap));
+	memmove(ed->gcstr + ed->gcgap, ed->gcstr + ed->gcgap + gcgapsiz,
+		sizeof(gcchar_t) * (pos - ed->gcgap));
+    }
+    ed->gap = idx;
+    ed->gcgap = pos;
+}
+
+/*
+ * Make room for CHARS characters and N clusters in the gap.
+ */
+static
+void editor_grow(gceditor_t *ed, size_t chars, size_t n)
+{
+    size_t siz, after;
+    void *p;
+
+    if (ed->siz - ed->len < chars) {
+	for (siz = ed->siz * 2; siz - ed->len < chars; )
+	    siz *= 2;
+	if ((p = realloc(ed->str, sizeof(unichar_t) * siz)) == NULL)
+	    croak("substr: %s", strerror(errno));
+	ed->str = p;
+	after = ed->len - ed->gap;
+	memmove(ed->str + siz - after, ed->str + ed->siz - after,
+		sizeof(unichar_t) * after);
+	ed->siz = siz;
+    }
+    if (ed->gcsiz - ed->gclen < n) {
+	for (siz = ed->gcsiz * 2; siz - ed->gclen < n; )
+	    siz *= 2;
+	if ((p = realloc(ed->gcstr, sizeof(gcchar_t) * siz)) == NULL)
+	    croak("substr: %s", strerror(errno));
+	ed->gcstr = p;
+	after = ed->gclen - ed->gcgap;
+	memmove(ed->gcstr + siz - after, ed->gcstr + ed->gcsiz - after,
+		sizeof(gcchar_t) * after);
+	ed->gcsiz = siz;
+    }
+}
+
+/*
+ * Replace clusters OFFSET..OFFSET+LENGTH with REPL.  Clusters adjacent to
+ * the edited range are segmented again along with REPL by the library.
+ */
+static
+void editor_replace(gceditor_t *ed, size_t offset, size_t length,
+		    gcstring_t *repl)
+{
+    gcstring_t *piece, *t;
+    size_t beg, end, idx, i;
+
+    beg = (0 < offset) ? offset - 1 : offset;
+    end = (offset + length < ed->gclen) ? offset + length + 1 : ed->gclen;
+    piece = editor_substr(ed, beg, offset - beg);
+    t = editor_substr(ed, offset + length, end - offset - length);
+    if ((repl != NULL && gcstring_append(piece, repl) == NULL) ||
+	gcstring_append(piece, t) == NULL)
+	croak("substr: %s", strerror(errno));
+    gcstring_destroy(t);
+
+    editor_move(ed, end);
+    idx = EDITOR_GCIDX(ed, beg);
+    ed->len -= ed->gap - idx;
+    ed->gclen -= end - beg;
+    ed->gap = idx;
+    ed->gcgap = beg;
+
+    editor_grow(ed, piece->len, piece->gclen);
+    if (piece->len)
+	memcpy(ed->str + ed->gap, piece->str,
+	       sizeof(unichar_t) * piece->len);
+    for (i = 0; i < piece->gclen; i++) {
+	ed->gcstr[ed->gcgap + i] = piece->gcstr[i];
+	ed->gcstr[ed->gcgap + i].idx += ed->gap;
+    }
+    ed->gap += piece->len;
+    ed->len += piece->len;
+    ed->gcgap += piece->gclen;
+    ed->gclen += piece->gclen;
+    gcstring_destroy(piece);
+}
+
+#ifdef USE_ITHREADS
+/***
+ *** Cloning objects for threads.
+ ***/
+
+#ifndef sv_dup_inc
+#  define sv_dup_inc(s, t) SvREFCNT_inc(sv_dup(s, t))
+#endif
+
+/*
+ * Copy linebreak object into new interpreter.  Objects referred by
+ * several Perl objects are copied only once.  Tailoring map is shared
+ * with the original.
+ */
+static
+linebreak_t *lbobj_dup(pTHX_ linebreak_t *obj, CLONE_PARAMS *param)
+{
+    linebreak_t *ret;
+    void (*ref)() = obj->ref_func;
+    size_t i;
+
+    if ((ret = ptr_table_fetch(PL_ptr_table, obj)) != NULL)
+	return linebreak_incref(ret);
+
+    /* References to SVs in original interpreter should not be counted. */
+    obj->ref_func = NULL;
+    ret = lbobj_share(obj);
+    obj->ref_func = ref;
+    if (ret == NULL)
+	croak("CLONE: %s", strerror(errno));
+    ret->ref_func = ref;
+
+    ret->stash = sv_dup_inc((SV *)obj->stash, param);
+    ret->format_data = sv_dup_inc((SV *)obj->format_data, param);
+    ret->sizing_data = sv_dup_inc((SV *)obj->sizing_data, param);
+    ret->urgent_data = sv_dup_inc((SV *)obj->urgent_data, param);
+    ret->user_data = sv_dup_inc((SV *)obj->user_data, param);
+    if (ret->prep_func != NULL && ret->prep_data != NULL)
+	for (i = 0; ret->prep_func[i] != NULL; i++)
+	    ret->prep_data[i] = sv_dup_inc((SV *)obj->prep_data[i], param);
+
+    ptr_table_store(PL_ptr_table, obj, ret);
+    return ret;
+}
+
+static
+int lbobj_svt_dup(pTHX_ MAGIC *mg, CLONE_PARAMS *param)
+{
+    SV *sv = mg->mg_obj; /* already cloned. */
+    linebreak_t *obj = INT2PTR(linebreak_t *, SvIVX(sv));
+
+    if (obj != NULL)
+	SvIV_set(sv, PTR2IV(lbobj_dup(aTHX_ obj, param)));
+    return 0;
+}
+
+static
+gcstring_t *gcstring_dup(pTHX_ gcstring_t *gcstr, CLONE_PARAMS *param)
+{
+    gcstring_t *ret;
+
+    if ((ret = gcstring_copy(gcstr)) == NULL)
+	croak("CLONE: %s", strerror(errno));
+    if (ret->lbobj != NULL) {
+	lbobj_destroy(ret->lbobj); /* just decrement count. */
+	ret->lbobj = lbobj_dup(aTHX_ gcstr->lbobj, param);
+    }
+    return ret;
+}
+
+static
+int gcstring_svt_dup(pTHX_ MAGIC *mg, CLONE_PARAMS *param)
+{
+    SV *sv = mg->mg_obj; /* already cloned. */
+    gcstring_t *gcstr = INT2PTR(gcstring_t *, SvIVX(sv));
+
+    if (gcstr != NULL)
+	SvIV_set(sv, PTR2IV(gcstring_dup(aTHX_ gcstr, param)));
+    return 0;
+}
+
+static
+int prepared_svt_dup(pTHX_ MAGIC *mg, CLONE_PARAMS *param)
+{
+    SV *sv = mg->mg_obj; /* already cloned. */
+    prepared_t *prep = INT2PTR(prepared_t *, SvIVX(sv)), *ret;
+    fragments_t *src, *frags;
+    size_t n, m, chars;
+
+    if (prep == NULL)
+	return 0;
+    src = prep->frags;
+    n = src->len;
+    m = src->nclusters;
+    chars = src->textlen;
+    if ((ret = malloc(sizeof(prepared_t))) == NULL ||
+	(frags = malloc(sizeof(fragments_t))) == NULL ||
+	(frags->str = malloc(sizeof(unichar_t) * (chars + 1))) == NULL ||
+	(frags->idx = malloc(sizeof(U32) * (m + 1))) == NULL ||
+	(frags->lbc = malloc(m + 1)) == NULL ||
+	(frags->elbc = malloc(m + 1)) == NULL ||
+	(frags->flag = malloc(m + 1)) == NULL ||
+	(frags->width = malloc(m + 1)) == NULL ||
+	(frags->beg = malloc(sizeof(U32) * (n + 1))) == NULL ||
+	(frags->spc = malloc(sizeof(U32) * (n + 1))) == NULL ||
+	(frags->brk = malloc(n + 1)) == NULL ||
+	(frags->cols = malloc(sizeof(double) * (n + 1))) == NULL ||
+	(frags->spccols = malloc(sizeof(double) * (n + 1))) == NULL)
+	croak("CLONE: %s", strerror(errno));
+    *ret = *prep;
+    ret->frags = frags;
+    ret->lbobj = lbobj_dup(aTHX_ prep->lbobj, param);
+    frags->lbobj = ret->lbobj;
+    frags->textlen = chars;
+    frags->textsiz = chars + 1;
+    frags->nclusters = m;
+    frags->gcsiz = m + 1;
+    frags->len = n;
+    frags->siz = n + 1;
+    if (chars)
+	memcpy(frags->str, src->str, sizeof(unichar_t) * chars);
+    memcpy(frags->idx, src->idx, sizeof(U32) * (m + 1));
+    if (m) {
+	memcpy(frags->lbc, src->lbc, m);
+	memcpy(frags->elbc, src->elbc, m);
+	memcpy(frags->flag, src->flag, m);
+	memcpy(frags->width, src->width, m);
+    }
+    memcpy(frags->beg, src->beg, sizeof(U32) * (n + 1));
+    if (n) {
+	memcpy(frags->spc, src->spc, sizeof(U32) * n);
+	memcpy(frags->brk, src->brk, n);
+	memcpy(frags->cols, src->cols, sizeof(double) * n);
+	memcpy(frags->spccols, src->spccols, sizeof(double) * n);
+    }
+    SvIV_set(sv, PTR2IV(ret));
+    return 0;
+}
+
+static
+int editor_svt_dup(pTHX_ MAGIC *mg, CLONE_PARAMS *param)
+{
+    SV *sv = mg->mg_obj; /* already cloned. */
+    gceditor_t *ed = INT2PTR(gceditor_t *, SvIVX(sv)), *ret;
+    size_t after, gcafter;
+
+    if (ed == NULL)
+	return 0;
+    if ((ret = malloc(sizeof(gceditor_t))) == NULL ||
+	(ret->str = malloc(sizeof(unichar_t) * ed->siz)) == NULL ||
+	(ret->gcstr = malloc(sizeof(gcchar_t) * ed->gcsiz)) == NULL)
+	croak("CLONE: %s", strerror(errno));
+    after = ed->len - ed->gap;
+    gcafter = ed->gclen - ed->gcgap;
+    memcpy(ret->str, ed->str, sizeof(unichar_t) * ed->gap);
+    memcpy(ret->str + ed->siz - after, ed->str + ed->siz - after,
+	   sizeof(unichar_t) * after);
+    memcpy(ret->gcstr, ed->gcstr, sizeof(gcchar_t) * ed->gcgap);
+    memcpy(ret->gcstr + ed->gcsiz - gcafter, ed->gcstr + ed->gcsiz - gcafter,
+	   sizeof(gcchar_t) * gcafter);
+    ret->len = ed->len;
+    ret->siz = ed->siz;
+    ret->gap = ed->gap;
+    ret->gclen = ed->gclen;
+    ret->gcsiz = ed->gcsiz;
+    ret->gcgap = ed->gcgap;
+    if (ed->lbobj != NULL)
+	ret->lbobj = lbobj_dup(aTHX_ ed->lbobj, param);
+    else
+	ret->lbobj = NULL;
+    SvIV_set(sv, PTR2IV(ret));
+    return 0;
+}
+
+static MGVTBL lbobj_vtbl = {
+    NULL, NULL, NULL, NULL, NULL, NULL, lbobj_svt_dup, NULL
+};
+static MGVTBL gcstring_vtbl = {
+    NULL, NULL, NULL, NULL, NULL, NULL, gcstring_svt_dup, NULL
+};
+static MGVTBL prepared_vtbl = {
+    NULL, NULL, NULL, NULL, NULL, NULL, prepared_svt_dup, NULL
+};
+static MGVTBL editor_vtbl = {
+    NULL, NULL, NULL, NULL, NULL, NULL, editor_svt_dup, NULL
+};
+
+/*
+ * Attach magic to inner SV of Perl object so that C object will be
+ * copied when the interpreter is cloned.
+ */
+static
+void setCtoPerl_magic(pTHX_ SV *sv, char *klass)
+{
+    MGVTBL *vtbl;
+    MAGIC *mg;
+
+    if (strcmp(klass, "Unicode::LineBreak") == 0)
+	vtbl = &lbobj_vtbl;
+    else if (strcmp(klass, "Unicode::GCString") == 0)
+	vtbl = &gcstring_vtbl;
+    else if (strcmp(klass, "Unicode::LineBreak::Prepared") == 0)
+	vtbl = &prepared_vtbl;
+    else if (strcmp(klass, "Unicode::GCString::Editor") == 0)
+	vtbl = &editor_vtbl;
+    else
+	croak("setCtoPerl: Unknown class %s", klass);
+    mg = sv_magicext(sv, sv, PERL_MAGIC_ext, vtbl, NULL, 0);
+    mg->mg_flags |= MGf_DUP;
+}
+#endif /* USE_ITHREADS */
+
+/***
+ *** Other utilities
+ ***/
+
+/*
+ * Do regex match once then returns offset and length.
+ */
+void do_pregexec_once(REGEXP *rx, unistr_t *str)
+{
+    SV *screamer;
+    char *str_arg, *str_beg, *str_end;
+    size_t offs_beg, offs_end;
+
+    screamer = unistrtoSV(str, 0, str->len);
+    SvREADONLY_on(screamer);
+    str_beg = str_arg = SvPVX(screamer);
+    str_end = SvEND(screamer);
+
+    if (pregexec(rx, str_arg, str_end, str_beg, 0, screamer, 1)) {
+#if PERL_VERSION >= 11
+	offs_beg = ((regexp *)SvANY(rx))->offs[0].start;
+	offs_end = ((regexp *)SvANY(rx))->offs[0].end;
+#elif ((PERL_VERSION == 10) || (PERL_VERSION == 9 && PERL_SUBVERSION >= 5))
+	offs_beg = rx->offs[0].start;
+	offs_end = rx->offs[0].end;
+#else /* PERL_VERSION */
+	offs_beg = rx->startp[0];
+	offs_end = rx->endp[0];
+#endif
+	str->str += utf8_length((U8 *)str_beg, (U8 *)(str_beg + offs_beg));
+	str->len = utf8_length((U8 *)(str_beg + offs_beg),
+			       (U8 *)(str_beg + offs_end));
+    } else
+	str->str = NULL;
+
+    SvREFCNT_dec(screamer);
+}
+
+/*
+ * Push I-th cluster onto Perl stack as plain scalars: string, columns,
+ * line breaking class and flag.
+ */
+static
+SV **gcstring_push_cluster(pTHX_ SV **sp, gcstring_t *gcstr, size_t i)
+{
+    gcchar_t *gc = gcstr->gcstr + i;
+
+    EXTEND(sp, 4);
+    PUSHs(sv_2mortal(unistrtoSV((unistr_t *)gcstr, gc->idx, gc->len)));
+    PUSHs(sv_2mortal(newSViv(gc->col)));
+    PUSHs(sv_2mortal(newSViv(gc->lbc)));
+    PUSHs(sv_2mortal(newSViv(gc->flag)));
+    return sp;
+}
+
+/*
+ * Property of every cluster packed into a string: one byte each but
+ * columns, which are native U16.
+ */
+#define GCSTRING_PROP_LBC (0)
+#define GCSTRING_PROP_LBCEXT (1)
+#define GCSTRING_PROP_EAW (2)
+#define GCSTRING_PROP_COLUMNS (3)
+#define GCSTRING_PROP_FLAG (4)
+
+static
+SV *gcstring_props(gcstring_t *gcstr, int prop)
+{
+    SV *ret;
+    U8 *p;
+    U16 col;
+    gcchar_t *gc;
+    size_t size = (prop == GCSTRING_PROP_COLUMNS) ? 2 : 1, i;
+    propval_t eaw;
+
+    ret = newSV(size * gcstr->gclen + 1);
+    SvPOK_only(ret);
+    p = (U8 *)SvPVX(ret);
+    for (i = 0, gc = gcstr->gcstr; i < gcstr->gclen; i++, gc++)
+	switch (prop) {
+	case GCSTRING_PROP_LBC:
+	    *p++ = gc->lbc;
+	    break;
+	case GCSTRING_PROP_LBCEXT:
+	    *p++ = (gc->elbc == PROP_UNKNOWN) ? gc->lbc : gc->elbc;
+	    break;
+	case GCSTRING_PROP_EAW:
+	    linebreak_charprop(gcstr->lbobj, gcstr->str[gc->idx], NULL, &eaw,
+			       NULL, NULL);
+	    *p++ = eaw;
+	    break;
+	case GCSTRING_PROP_COLUMNS:
+	    col = (U16)gc->col;
+	    memcpy(p, &col, 2);
+	    p += 2;
+	    break;
+	default:
+	    *p++ = gc->flag;
+	    break;
+	}
+    *p = '\0';
+    SvCUR_set(ret, size * gcstr->gclen);
+    return ret;
+}
+
+/*
+ * Packed record of cluster: offset and length by characters (native U32),
+ * columns, line breaking class, extended one and flag (U8).
+ */
+#define GCSTRING_RECORD_SIZE (12)
+
+/***
+ *** Callbacks for Sombok library.
+ ***/
+
+/*
+ * Increment/decrement reference count
+ */
+void ref_func(void *sv, int datatype, int d)
+{
+    if (sv == NULL)
+	return;
+    if (0 < d)
+	SvREFCNT_inc((SV *)sv);
+    else if (d < 0)
+	SvREFCNT_dec((SV *)sv);
+}
+
+/*
+ * Call preprocessing function
+ */
+static
+gcstring_t *prep_func(linebreak_t *lbobj, void *dataref, unistr_t *str,
+		      unistr_t *text)
+{
+    AV *data;
+    SV *sv, **pp, *func = NULL;
+    REGEXP *rx = NULL;
+    size_t count, i, j;
+    gcstring_t *gcstr, *ret;
+
+    if (dataref == NULL ||
+	(data = (AV *)SvRV((SV *)dataref)) == NULL)
+	return (lbobj->errnum = EINVAL), NULL;
+
+    /* Pass I */
+
+    if (text != NULL) {
+	if ((pp = av_fetch(data, 0, 0)) == NULL)
+	    return (lbobj->errnum = EINVAL), NULL;
+
+#if ((PERL_VERSION >= 10) || (PERL_VERSION >= 9 && PERL_SUBVERSION >= 5))
+	if (SvRXOK(*pp))
+	    rx = SvRX(*pp);
+#else /* PERL_VERSION */
+	if (SvROK(*pp) && SvMAGICAL(sv = SvRV(*pp))) {
+	    MAGIC *mg;
+	    if ((mg = mg_find(sv, PERL_MAGIC_qr)) != NULL)
+		rx = (REGEXP *)mg->mg_obj;
+	}
+#endif /* PERL_VERSION */
+	if (rx == NULL)
+	    return (lbobj->errnum = EINVAL), NULL;
+
+	do_pregexec_once(rx, str);
+	return NULL;
+    }
+
+    /* Pass II */
+
+    if ((pp = av_fetch(data, 1, 0)) == NULL)
+        func = NULL;
+    else if (SvOK(*pp))
+        func = *pp;
+    else
+        func = NULL;
+
+    if (func == NULL) {
+	if ((ret = gcstring_newcopy(str, lbobj)) == NULL)
+	    return (lbobj->errnum = errno ? errno : ENOMEM), NULL;
+    } else {
+	dSP;
+	ENTER;
+	SAVETMPS;
+	PUSHMARK(SP);
+	linebreak_incref(lbobj); /* mortal but should not be destroyed.*/
+	XPUSHs(sv_2mortal(CtoPerl("Unicode::LineBreak", lbobj)));
+	XPUSHs(sv_2mortal(unistrtoSV(str, 0, str->len)));
+	PUTBACK;
+	count = call_sv(func, G_ARRAY | G_EVAL);
+
+	SPAGAIN;
+	if (SvTRUE(ERRSV)) {
+	    if (!lbobj->errnum)
+		 lbobj->errnum = LINEBREAK_EEXTN;
+	    return NULL;
+	}
+
+	if ((ret = gcstring_new(NULL, lbobj)) == NULL)
+	    return (lbobj->errnum = errno ? errno : ENOMEM), NULL;
+
+	for (i = 0; i < count; i++) {
+	    sv = POPs;
+	    if (!SvOK(sv))
+		continue;
+	    gcstr = SVtogcstring(sv, lbobj);
+
+	    for (j = 0; j < gcstr->gclen; j++) {
+		if (gcstr->gcstr[j].flag &
+		    (LINEBREAK_FLAG_ALLOW_BEFORE |
+		     LINEBREAK_FLAG_PROHIBIT_BEFORE))
+		    continue;
+		if (i < count - 1 && j == 0)
+		    gcstr->gcstr[j].flag |= LINEBREAK_FLAG_ALLOW_BEFORE;
+		else if (0 < j)
+		    gcstr->gcstr[j].flag |= LINEBREAK_FLAG_PROHIBIT_BEFORE;
+	    }
+
+	    gcstring_replace(ret, 0, 0, gcstr);
+	    if (!sv_isobject(sv))
+		gcstring_destroy(gcstr);
+	}
+
+	PUTBACK;
+	FREETMPS;
+	LEAVE;
+    }
+
+    return ret;
+}
+
+/*
+ * Call format function
+ */
+static
+char *linebreak_states[] = {
+    NULL, "sot", "sop", "sol", "", "eol", "eop", "eot", NULL
+};
+static
+gcstring_t *format_func(linebreak_t *lbobj, linebreak_state_t action,
+			gcstring_t *str)
+{
+    SV *sv;
+    char *actionstr;
+    int count;
+    gcstring_t *ret;
+
+    dSP;
+    if (action <= LINEBREAK_STATE_NONE || LINEBREAK_STATE_MAX <= action)
+	return NULL;
+    actionstr = linebreak_states[(size_t)action];
+    ENTER;
+    SAVETMPS;
+    PUSHMARK(SP);
+    linebreak_incref(lbobj); /* mortal but should not be destroyed. */
+    XPUSHs(sv_2mortal(CtoPerl("Unicode::LineBreak", lbobj)));
+    XPUSHs(sv_2mortal(newSVpv(actionstr, 0)));
+    XPUSHs(sv_2mortal(CtoPerl("Unicode::GCString", gcstring_copy(str))));
+    PUTBACK;
+    count = call_sv(lbobj->format_data, G_SCALAR | G_EVAL);
+
+    SPAGAIN;
+    if (SvTRUE(ERRSV)) {
+	if (!lbobj->errnum)
+	    lbobj->errnum = LINEBREAK_EEXTN;
+	POPs;
+	return NULL;
+    } else if (count != 1)
+	croak("format_func: internal error");
+    else
+	sv = POPs;
+    if (!SvOK(sv))
+	ret = NULL;
+    else
+	ret = SVtogcstring(sv, lbobj);
+    if (sv_isobject(sv))
+	ret = gcstring_copy(ret);
+
+    PUTBACK;
+    FREETMPS;
+    LEAVE;
+
+    return ret;
+}
+
+/*
+ * Call sizing function
+ */
+static
+double sizing_func(linebreak_t *lbobj, double len,
+		   gcstring_t *pre, gcstring_t *spc, gcstring_t *str)
+{
+    int count;
+    double ret;
+
+    dSP;
+    ENTER;
+    SAVETMPS;
+    PUSHMARK(SP);
+    linebreak_incref(lbobj); /* mortal but should not be destroyed. */
+    XPUSHs(sv_2mortal(CtoPerl("Unicode::LineBreak", lbobj)));
+    XPUSHs(sv_2mortal(newSVnv(len))); 
+    XPUSHs(sv_2mortal(CtoPerl("Unicode::GCString", gcstring_copy(pre))));
+    XPUSHs(sv_2mortal(CtoPerl("Unicode::GCString", gcstring_copy(spc))));
+    XPUSHs(sv_2mortal(CtoPerl("Unicode::GCString", gcstring_copy(str))));
+    PUTBACK;
+    count = call_sv(lbobj->sizing_data, G_SCALAR | G_EVAL);
+
+    SPAGAIN;
+    if (SvTRUE(ERRSV)) {
+	if (!lbobj->errnum)
+	    lbobj->errnum = LINEBREAK_EEXTN;
+	POPs;
+	return -1;
+    } else if (count != 1)
+	croak("sizing_func: internal error");
+    else
+	ret = POPn;
+
+    PUTBACK;
+    FREETMPS;
+    LEAVE;
+
+    return ret;
+}
+
+/*
+ * Call urgent breaking function
+ */
+static
+gcstring_t *urgent_func(linebreak_t *lbobj, gcstring_t *str)
+{
+    SV *sv;
+    int count;
+    size_t i;
+    gcstring_t *gcstr, *ret;
+
+    dSP;
+    ENTER;
+    SAVETMPS;
+    PUSHMARK(SP);
+    linebreak_incref(lbobj); /* mortal but should not be destroyed. */
+    XPUSHs(sv_2mortal(CtoPerl("Unicode::LineBreak", lbobj)));
+    XPUSHs(sv_2mortal(CtoPerl("Unicode::GCString", gcstring_copy(str))));
+    PUTBACK;
+    count = call_sv(lbobj->urgent_data, G_ARRAY | G_EVAL);
+
+    SPAGAIN;
+    if (SvTRUE(ERRSV)) {
+	if (!lbobj->errnum)
+	    lbobj->errnum = LINEBREAK_EEXTN;
+	return NULL;
+    } if (count == 0)
+	return NULL;
+
+    ret = gcstring_new(NULL, lbobj);
+    for (i = count; i; i--) {
+	sv = POPs;
+	if (SvOK(sv)) {
+	    gcstr = SVtogcstring(sv, lbobj);
+	    if (gcstr->gclen)
+		gcstr->gcstr[0].flag = LINEBREAK_FLAG_ALLOW_BEFORE;
+	    gcstring_replace(ret, 0, 0, gcstr);
+	    if (!sv_isobject(sv))
+		gcstring_destroy(gcstr);
+	}
+    }
+
+    PUTBACK;
+    FREETMPS;
+    LEAVE;
+
+    return ret;
+}
+
+/***
+ *** Breaking opportunities.
+ ***/
+
+#define BREAK_IS_NEWLINE(lbc) \
+    ((lbc) == LB_BK || (lbc) == LB_CR || (lbc) == LB_LF || (lbc) == LB_NL)
+
+/*
+ * Append STR, a part of TEXT, to RET breaking it by FINDEX-th and later
+ * user-defined breaking functions (Prep).  Each match of a function is
+ * given to it and the rest is given to the next function, as the library
+ * does.  Returns false on error.
+ */
+static
+int break_prep(linebreak_t *obj, gcstring_t *ret, unistr_t *str,
+	       unistr_t *text, size_t findex)
+{
+    gcstring_t *(*func)(), *s;
+    void *data;
+    unistr_t plain, match;
+    unichar_t *end = str->str + str->len;
+
+    if (str->len == 0)
+	return 1;
+    if (obj->prep_func == NULL || (func = obj->prep_func[findex]) == NULL) {
+	if ((s = gcstring_newcopy(str, obj)) == NULL)
+	    return (obj->errnum = errno ? errno : ENOMEM), 0;
+	gcstring_append(ret, s);
+	gcstring_destroy(s);
+	return 1;
+    }
+    data = (obj->prep_data == NULL) ? NULL : obj->prep_data[findex];
+
+    plain.str = match.str = str->str;
+    while (plain.str < end) {
+	/* Pass I: Find the next match. */
+	match.len = end - match.str;
+	(*func)(obj, data, &match, text);
+	if (obj->errnum)
+	    return 0;
+	if (match.str != NULL && match.len == 0) {
+	    /* Empty match: Search after it. */
+	    if (++match.str < end)
+		continue;
+	    match.str = NULL;
+	}
+	plain.len = ((match.str == NULL) ? end : match.str) - plain.str;
+	if (!break_prep(obj, ret, &plain, text, findex + 1))
+	    return 0;
+	if (match.str == NULL)
+	    break;
+
+	/* Pass II: Break the match. */
+	if ((s = (*func)(obj, data, &match, NULL)) == NULL) {
+	    if (obj->errnum)
+		return 0;
+	    if ((s = gcstring_newcopy(&match, obj)) == NULL)
+		return (obj->errnum = errno ? errno : ENOMEM), 0;
+	}
+	gcstring_append(ret, s);
+	gcstring_destroy(s);
+	plain.str = match.str = match.str + match.len;
+    }
+    return 1;
+}
+
+/*
+ * Find breaking opportunities of GCSTR by the pair table, in the same way
+ * as linebreak_break() does.  ACTION[i] is set to the action before i-th
+ * cluster: LINEBREAK_ACTION_MANDATORY, LINEBREAK_ACTION_DIRECT where break
+ * is allowed, or LINEBREAK_ACTION_PROHIBITED.
+ */
+static
+void break_actions(linebreak_t *obj, gcstring_t *gcstr,
+		   unsigned char *action)
+{
+    gcchar_t *gc;
+    size_t i;
+    propval_t lbc, blbc = PROP_UNKNOWN, r;
+    int spc = 0, zw = 0;
+
+    for (i = 0; i < gcstr->gclen; i++) {
+	gc = gcstr->gcstr + i;
+	lbc = gc->lbc;
+	r = LINEBREAK_ACTION_PROHIBITED;
+
+	if (i == 0)
+	    ;
+	/* LB4, LB5: Break after newlines. */
+	else if (BREAK_IS_NEWLINE(gcstr->gcstr[i - 1].lbc)) {
+	    r = LINEBREAK_ACTION_MANDATORY;
+	    blbc = PROP_UNKNOWN;
+	    spc = zw = 0;
+	}
+	/* LB6, LB7: Don't break before newlines, SP and ZW. */
+	else if (BREAK_IS_NEWLINE(lbc) || lbc == LB_SP || lbc == LB_ZW)
+	    ;
+	/* LB8: Break after ZW SP*. */
+	else if (zw)
+	    r = LINEBREAK_ACTION_DIRECT;
+	/* User-defined breaking. */
+	else if (gc->flag & LINEBREAK_FLAG_ALLOW_BEFORE)
+	    r = LINEBREAK_ACTION_DIRECT;
+	else if (gc->flag & LINEBREAK_FLAG_PROHIBIT_BEFORE)
+	    ;
+	/* SPACEs at beginning of line. */
+	else if (blbc == PROP_UNKNOWN) {
+	    if (spc && (obj->options & LINEBREAK_OPTION_BREAK_INDENT))
+		r = LINEBREAK_ACTION_DIRECT;
+	}
+	/* LB9: Treat X CM* as X. */
+	else if (lbc == LB_CM && !spc) {
+	    action[i] = r;
+	    continue;
+	}
+	/* LB10: Treat other CM as AL.  Indirect break needs SPACEs. */
+	else {
+	    r = linebreak_get_lbrule(obj, blbc, (lbc == LB_CM) ? LB_AL : lbc);
+	    if (r == LINEBREAK_ACTION_INDIRECT && spc)
+		r = LINEBREAK_ACTION_DIRECT;
+	    else if (r != LINEBREAK_ACTION_DIRECT)
+		r = LINEBREAK_ACTION_PROHIBITED;
+	}
+	action[i] = r;
+
+	if (lbc == LB_SP) {
+	    spc = 1;
+	    continue;
+	}
+	if (lbc == LB_CM)
+	    blbc = LB_AL;
+	else if (gc->elbc != PROP_UNKNOWN && gc->elbc != LB_CM)
+	    blbc = gc->elbc;
+	else
+	    blbc = lbc;
+	spc = 0;
+	zw = (lbc == LB_ZW);
+    }
+}
+
+/*
+ * Text broken by Prep with actions before its clusters.
+ */
+typedef struct {
+    gcstring_t *gcstr;
+    unsigned char *action;
+    int borrowed;	/* Unicode buffer of gcstr is borrowed */
+    fragments_t *frags;	/* made of them unless taken */
+} breaks_t;
+
+static void layout_free_fragments(fragments_t *);
+
+static
+void breaks_free(pTHX_ void *data)
+{
+    breaks_t *breaks = (breaks_t *)data;
+
+    layout_free_fragments(breaks->frags);
+
+    if (breaks->gcstr != NULL) {
+	if (breaks->borrowed) {
+	    breaks->gcstr->str = NULL;
+	    breaks->gcstr->len = 0;
+	}
+	gcstring_destroy(breaks->gcstr);
+    }
+    free(breaks->action);
+    free(breaks);
+}
+
+/*
+ * Find breaking opportunities of INPUT.  Result is released by LEAVE in
+ * the scope of caller.  Returns NULL on error.
+ */
+static
+breaks_t *breaks_new(pTHX_ linebreak_t *obj, unistr_t *input)
+{
+    breaks_t *ret;
+
+    if ((ret = malloc(sizeof(breaks_t))) == NULL)
+	croak("breaks_new: %s", strerror(errno));
+    memset(ret, 0, sizeof(breaks_t));
+    SAVEDESTRUCTOR_X(breaks_free, ret);
+
+    obj->errnum = 0;
+    if (obj->prep_func == NULL || obj->prep_func[0] == NULL) {
+	/* Unicode buffer is borrowed from INPUT. */
+	if ((ret->gcstr = gcstring_new(input, obj)) == NULL)
+	    croak("breaks_new: %s", strerror(errno));
+	ret->borrowed = 1;
+    } else {
+	if ((ret->gcstr = gcstring_new(NULL, obj)) == NULL)
+	    croak("breaks_new: %s", strerror(errno));
+	if (!break_prep(obj, ret->gcstr, input, input, 0))
+	    return NULL;
+    }
+    if ((ret->action = malloc(ret->gcstr->gclen + 1)) == NULL)
+	croak("breaks_new: %s", strerror(errno));
+    break_actions(obj, ret->gcstr, ret->action);
+    return ret;
+}
+
+/***
+ *** Layout of fragments.
+ ***/
+
+/*
+ * Text is split into fragments at every breaking opportunity, then
+ * fragments are fit into lines either greedily or optimally.  Prepared
+ * object keeps fragments so that text may be laid out several times.
+ *
+ * Optimal-fit layout is the total-fit algorithm of Knuth and Plass, set
+ * ragged right.  Text of a fragment is a box, its SPACEs are glue which
+ * is discarded at a break, and the break after it is a penalty: zero for
+ * arbitrary break, LAYOUT_URGENT_PENALTY for urgent break, and forced for
+ * mandatory break.  Glue of right margin stretches by ColMax, so badness
+ * of a line is 100 r^3 where r is ratio of unused columns to ColMax; the
+ * last line of each paragraph is filled and has no badness.  A line
+ * exceeding ColMax is never made unless it consists of only one
+ * fragment.  Such a line and lines shorter than ColMin are awful.
+ * Demerits of a line are (l + b)^2 + p^2, with additional demerits for
+ * consecutive urgent breaks and for adjacent lines of fitness classes
+ * not next to each other.  Breaking positions are chosen so that sum of
+ * demerits of lines would be minimal.  Since the lines examined from a
+ * position are bounded by ColMax, the cost is O(n) for n breaking
+ * opportunities.
+ */
+#define LAYOUT_BREAK_ARBITRARY (0)
+#define LAYOUT_BREAK_URGENT (1)
+#define LAYOUT_BREAK_MANDATORY (2)
+
+#define LAYOUT_LINE_PENALTY (10.0)
+#define LAYOUT_URGENT_PENALTY (50.0)
+#define LAYOUT_DOUBLE_URGENT_DEMERITS (10000.0)
+#define LAYOUT_ADJ_DEMERITS (10000.0)
+#define LAYOUT_AWFUL_BAD (10000.0)
+/* Fitness classes: very loose, loose and decent.  No line is shrunk. */
+#define LAYOUT_FITNESS (3)
+#define LAYOUT_FITNESS_OF(b) (((b) < 13.0) ? 2 : ((b) < 100.0) ? 1 : 0)
+
+/*
+ * Buffers used during layout.  They are released through the save stack
+ * so that nothing would leak even if a callback croaks.
+ */
+typedef struct {
+    fragments_t *frags;	/* fragments given */
+    fragments_t *work;	/* fragments broken by urgent breaking */
+    size_t *ends;	/* end positions of lines */
+    double *best;	/* costs and links of optimal layout */
+    size_t *prev;
+    double *cols;	/* columns of lines */
+    gcstring_t *pre;	/* text of line, if sizes are not cached */
+    gcstring_t *str;	/* string given to or returned by callback */
+    gcstring_t *empty;
+    gcstring_t **lines;	/* result */
+    size_t nlines;	/* number of lines laid out greedily */
+    size_t siz;		/* allocated size of lines and cols */
+} layout_scratch_t;
+
+/*
+ * Grapheme cluster string of clusters OFFSET..OFFSET+LENGTH of text.
+ */
+static
+gcstring_t *layout_substr(fragments_t *frags, size_t offset, size_t length)
+{
+    gcstring_t *ret;
+    size_t i, idx;
+
+    if ((ret = gcstring_new(NULL, frags->lbobj)) == NULL)
+	croak("layout_substr: %s", strerror(errno));
+    if (length == 0)
+	return ret;
+
+    idx = frags->idx[offset];
+    ret->len = frags->idx[offset + length] - idx;
+    if ((ret->str = malloc(sizeof(unichar_t) * ret->len)) == NULL ||
+	(ret->gcstr = malloc(sizeof(gcchar_t) * length)) == NULL)
+	croak("layout_substr: %s", strerror(errno));
+    memcpy(ret->str, frags->str + idx, sizeof(unichar_t) * ret->len);
+    for (i = 0; i < length; i++) {
+	ret->gcstr[i].idx = frags->idx[offset + i] - idx;
+	ret->gcstr[i].len = frags->idx[offset + i + 1] -
+	    frags->idx[offset + i];
+	ret->gcstr[i].col = frags->width[offset + i];
+	ret->gcstr[i].lbc = frags->lbc[offset + i];
+	ret->gcstr[i].elbc = frags->elbc[offset + i];
+	ret->gcstr[i].flag = frags->flag[offset + i];
+    }
+    ret->gclen = length;
+    return ret;
+}
+
+/* Text and SPACEs of I-th fragment. */
+#define layout_str(frags, i) \
+    layout_substr((frags), (frags)->beg[i], (frags)->spc[i] - (frags)->beg[i])
+#define layout_spc(frags, i) \
+    layout_substr((frags), (frags)->spc[i], \
+		  (frags)->beg[(i) + 1] - (frags)->spc[i])
+
+/* Number of characters of clusters BEG..END. */
+#define layout_chars(frags, beg, end) \
+    ((size_t)((frags)->idx[end] - (frags)->idx[beg]))
+
+static
+double layout_sizing(linebreak_t *obj, double len, gcstring_t *pre,
+		     gcstring_t *spc, gcstring_t *str)
+{
+    if (obj->sizing_func == NULL)
+	return len + (double)spc->gclen + (double)str->gclen;
+    return (*obj->sizing_func)(obj, len, pre, spc, str);
+}
+
+/*
+ * Call format function.  STR is replaced by the result, or destroyed on
+ * error and NULL is returned.
+ */
+static
+gcstring_t *layout_format(linebreak_t *obj, linebreak_state_t state,
+			  gcstring_t *str)
+{
+    gcstring_t *ret;
+
+    if (obj->format_func == NULL)
+	return str;
+    if ((ret = (*obj->format_func)(obj, state, str)) == NULL) {
+	if (!obj->errnum)
+	    return str;
+	gcstring_destroy(str);
+	return NULL;
+    }
+    gcstring_destroy(str);
+    return ret;
+}
+
+#define LAYOUT_GROW(ptr, siz) \
+    STMT_START { \
+	void *p = realloc((ptr), sizeof(*(ptr)) * (siz)); \
+	if (p == NULL) \
+	    croak("layout_grow: %s", strerror(errno)); \
+	(ptr) = p; \
+    } STMT_END
+
+static
+void layout_free_fragments(fragments_t *frags)
+{
+    if (frags == NULL)
+	return;
+    free(frags->str);
+    free(frags->idx);
+    /* Properties of clusters may be mapped from break index. */
+    if (!sharedbuf_dec(frags->lbc)) {
+	free(frags->lbc);
+	free(frags->elbc);
+	free(frags->flag);
+	free(frags->width);
+    }
+    free(frags->beg);
+    free(frags->spc);
+    free(frags->brk);
+    free(frags->cols);
+    free(frags->spccols);
+    free(frags);
+}
+
+/*
+ * Make room for N more fragments.
+ */
+static
+void layout_grow(fragments_t *frags, size_t n)
+{
+    size_t siz;
+
+    if (frags->len + n < frags->siz)
+	return;
+    for (siz = frags->siz ? frags->siz : 64; siz <= frags->len + n; )
+	siz *= 2;
+    LAYOUT_GROW(frags->beg, siz);
+    LAYOUT_GROW(frags->spc, siz);
+    LAYOUT_GROW(frags->brk, siz);
+    LAYOUT_GROW(frags->cols, siz);
+    LAYOUT_GROW(frags->spccols, siz);
+    frags->siz = siz;
+    if (frags->len == 0)
+	frags->beg[0] = 0;
+}
+
+/*
+ * Make room for CHARS more characters and N more clusters of text.
+ */
+static
+void layout_grow_text(fragments_t *frags, size_t chars, size_t n)
+{
+    size_t siz;
+
+    if ((U32)(frags->textlen + chars) != frags->textlen + chars)
+	croak("layout_grow_text: Text too long");
+    if (frags->textsiz < frags->textlen + chars) {
+	for (siz = frags->textsiz ? frags->textsiz : 256;
+	     siz < frags->textlen + chars; )
+	    siz *= 2;
+	LAYOUT_GROW(frags->str, siz);
+	frags->textsiz = siz;
+    }
+    if (frags->gcsiz <= frags->nclusters + n) {
+	for (siz = frags->gcsiz ? frags->gcsiz : 64;
+	     siz <= frags->nclusters + n; )
+	    siz *= 2;
+	LAYOUT_GROW(frags->idx, siz);
+	LAYOUT_GROW(frags->lbc, siz);
+	LAYOUT_GROW(frags->elbc, siz);
+	LAYOUT_GROW(frags->flag, siz);
+	LAYOUT_GROW(frags->width, siz);
+	if (frags->gcsiz == 0)
+	    frags->idx[0] = 0;
+	frags->gcsiz = siz;
+    }
+}
+
+static
+fragments_t *layout_new_fragments(linebreak_t *obj)
+{
+    fragments_t *frags;
+
+    if ((frags = malloc(sizeof(fragments_t))) == NULL)
+	croak("layout_new_fragments: %s", strerror(errno));
+    memset(frags, 0, sizeof(fragments_t));
+    frags->lbobj = obj;
+    layout_grow(frags, 0);
+    layout_grow_text(frags, 0, 0);
+    return frags;
+}
+
+/*
+ * Append clusters BEG..END of SRC to text as they are, without segmenting
+ * them again.
+ */
+static
+void layout_concat(fragments_t *frags, gcstring_t *src, size_t beg,
+		   size_t end)
+{
+    size_t idx, chars, i, n;
+
+    if (end <= beg)
+	return;
+    idx = src->gcstr[beg].idx;
+    chars = src->gcstr[end - 1].idx + src->gcstr[end - 1].len - idx;
+    layout_grow_text(frags, chars, end - beg);
+
+    memcpy(frags->str + frags->textlen, src->str + idx,
+	   sizeof(unichar_t) * chars);
+    for (i = beg, n = frags->nclusters; i < end; i++, n++) {
+	if (255 < src->gcstr[i].col)
+	    croak("layout_concat: Cluster too wide");
+	frags->idx[n] = src->gcstr[i].idx - idx + frags->textlen;
+	frags->lbc[n] = src->gcstr[i].lbc;
+	frags->elbc[n] = src->gcstr[i].elbc;
+	frags->flag[n] = src->gcstr[i].flag;
+	frags->width[n] = src->gcstr[i].col;
+    }
+    frags->textlen += chars;
+    frags->nclusters = n;
+    frags->idx[n] = frags->textlen;
+}
+
+/*
+ * Append clusters BEG..END of text of SRC.
+ */
+static
+void layout_concat_text(fragments_t *frags, fragments_t *src, size_t beg,
+			size_t end)
+{
+    size_t chars = layout_chars(src, beg, end), n = end - beg, i;
+    U32 delta;
+
+    if (n == 0)
+	return;
+    layout_grow_text(frags, chars, n);
+    delta = frags->textlen - src->idx[beg];
+    memcpy(frags->str + frags->textlen, src->str + src->idx[beg],
+	   sizeof(unichar_t) * chars);
+    for (i = 0; i < n; i++)
+	frags->idx[frags->nclusters + i] = src->idx[beg + i] + delta;
+    memcpy(frags->lbc + frags->nclusters, src->lbc + beg, n);
+    memcpy(frags->elbc + frags->nclusters, src->elbc + beg, n);
+    memcpy(frags->flag + frags->nclusters, src->flag + beg, n);
+    memcpy(frags->width + frags->nclusters, src->width + beg, n);
+    frags->textlen += chars;
+    frags->nclusters += n;
+    frags->idx[frags->nclusters] = frags->textlen;
+}
+
+/*
+ * Make clusters appended after the last fragment into a new fragment.
+ * SPC is position of its SPACEs.
+ */
+static
+void layout_push(fragments_t *frags, size_t spc, int brk)
+{
+    size_t i = frags->len;
+
+    layout_grow(frags, 1);
+    frags->spc[i] = spc;
+    frags->beg[i + 1] = frags->nclusters;
+    frags->brk[i] = brk;
+    frags->len++;
+}
+
+/*
+ * Append fragments FROM..TO of SRC including their sizes.
+ */
+static
+void layout_copy(fragments_t *frags, fragments_t *src, size_t from,
+		 size_t to)
+{
+    size_t i, j;
+    U32 delta;
+
+    if (to <= from)
+	return;
+    layout_grow(frags, to - from);
+    delta = frags->nclusters - src->beg[from];
+    layout_concat_text(frags, src, src->beg[from], src->beg[to]);
+    for (i = from, j = frags->len; i < to; i++, j++) {
+	frags->spc[j] = src->spc[i] + delta;
+	frags->beg[j + 1] = src->beg[i + 1] + delta;
+    }
+    memcpy(frags->brk + frags->len, src->brk + from, to - from);
+    memcpy(frags->cols + frags->len, src->cols + from,
+	   sizeof(double) * (to - from));
+    memcpy(frags->spccols + frags->len, src->spccols + from,
+	   sizeof(double) * (to - from));
+    frags->len = j;
+}
+
+/*
+ * Sum of N widths of clusters.  Widths have been resolved by the library
+ * according to context and tailoring.
+ */
+static
+double layout_width_sum(unsigned char *width, size_t n)
+{
+    size_t i, ret = 0;
+
+    for (i = 0; i < n; i++)
+	ret += width[i];
+    return (double)ret;
+}
+
+/*
+ * Measure I-th fragment.  Sizes are cached only if sizing method is
+ * additive: UAX11 method sums up columns of clusters and default one
+ * counts clusters.
+ */
+static
+void layout_measure(linebreak_t *obj, fragments_t *frags, size_t i)
+{
+    unsigned char *width = frags->width;
+    double cols, spccols;
+
+    if (obj->sizing_func == NULL) {
+	cols = (double)(frags->spc[i] - frags->beg[i]);
+	spccols = (double)(frags->beg[i + 1] - frags->spc[i]);
+    } else if (obj->sizing_func ==
+	       (double (*)())linebreak_sizing_UAX11) {
+	cols = layout_width_sum(width + frags->beg[i],
+				frags->spc[i] - frags->beg[i]);
+	spccols = layout_width_sum(width + frags->spc[i],
+				   frags->beg[i + 1] - frags->spc[i]);
+    } else
+	cols = spccols = -1.0;
+    frags->cols[i] = cols;
+    frags->spccols[i] = spccols;
+}
+
+/*
+ * Split text into fragments at every breaking opportunity.  Returns NULL
+ * on error.
+ */
+static
+fragments_t *layout_fragments(linebreak_t *obj, unistr_t *input)
+{
+    dTHX;
+    breaks_t *breaks;
+    gcstring_t *gcstr;
+    fragments_t *frags = NULL;
+    size_t beg, end, s, e, n;
+
+    ENTER;
+    if ((breaks = breaks_new(aTHX_ obj, input)) != NULL) {
+	gcstr = breaks->gcstr;
+	frags = breaks->frags = layout_new_fragments(obj);
+	for (beg = 0; beg < gcstr->gclen; beg = end) {
+	    for (end = beg + 1; end < gcstr->gclen &&
+		 breaks->action[end] == LINEBREAK_ACTION_PROHIBITED; end++)
+		;
+	    /* Trailing newline and SPACEs. */
+	    e = end;
+	    if (BREAK_IS_NEWLINE(gcstr->gcstr[e - 1].lbc))
+		e--;
+	    for (s = e; beg < s && gcstr->gcstr[s - 1].lbc == LB_SP; s--)
+		;
+	    n = frags->nclusters;
+	    layout_concat(frags, gcstr, beg, end);
+	    layout_push(frags, n + s - beg,
+			(e < end) ? LAYOUT_BREAK_MANDATORY :
+			LAYOUT_BREAK_ARBITRARY);
+	    layout_measure(obj, frags, frags->len - 1);
+	}
+	breaks->frags = NULL;
+    }
+    LEAVE;
+    return frags;
+}
+
+static
+void layout_scratch_free(pTHX_ void *data)
+{
+    layout_scratch_t *scratch = (layout_scratch_t *)data;
+
+    if (scratch->work != scratch->frags)
+	layout_free_fragments(scratch->work);
+    free(scratch->ends);
+    free(scratch->best);
+    free(scratch->prev);
+    free(scratch->cols);
+    if (scratch->pre != NULL)
+	gcstring_destroy(scratch->pre);
+    if (scratch->str != NULL)
+	gcstring_destroy(scratch->str);
+    if (scratch->empty != NULL)
+	gcstring_destroy(scratch->empty);
+    if (scratch->lines != NULL)
+	linebreak_free_result(scratch->lines, 1);
+    free(scratch);
+}
+
+/*
+ * Scratch buffers to lay out FRAGS.  They are released by LEAVE in the
+ * scope of caller.
+ */
+static
+layout_scratch_t *layout_scratch_new(pTHX_ linebreak_t *obj,
+				     fragments_t *frags)
+{
+    layout_scratch_t *scratch;
+
+    if ((scratch = malloc(sizeof(layout_scratch_t))) == NULL)
+	croak("layout_scratch_new: %s", strerror(errno));
+    memset(scratch, 0, sizeof(layout_scratch_t));
+    scratch->frags = scratch->work = frags;
+    SAVEDESTRUCTOR_X(layout_scratch_free, scratch);
+    if ((scratch->empty = gcstring_new(NULL, obj)) == NULL)
+	croak("layout_scratch_new: %s", strerror(errno));
+    return scratch;
+}
+
+/* Text of line kept for sizing method. */
+static
+gcstring_t *layout_scratch_pre(layout_scratch_t *scratch, linebreak_t *obj)
+{
+    if (scratch->pre != NULL)
+	gcstring_destroy(scratch->pre);
+    scratch->pre = NULL;
+    if ((scratch->pre = gcstring_new(NULL, obj)) == NULL)
+	croak("layout_scratch_pre: %s", strerror(errno));
+    return scratch->pre;
+}
+
+static
+void layout_scratch_unpre(layout_scratch_t *scratch)
+{
+    if (scratch->pre != NULL)
+	gcstring_destroy(scratch->pre);
+    scratch->pre = NULL;
+}
+
+/* Hold STR instead of string held so far. */
+static
+gcstring_t *layout_scratch_hold(layout_scratch_t *scratch, gcstring_t *str)
+{
+    if (scratch->str != NULL)
+	gcstring_destroy(scratch->str);
+    return scratch->str = str;
+}
+
+/*
+ * Break fragments beyond CharMax or ColMax by urgent breaking function.
+ * New fragments are stored into work member of SCRATCH if anything is
+ * broken.  Returns false on error.
+ */
+static
+int layout_urgent(linebreak_t *obj, layout_scratch_t *scratch)
+{
+    fragments_t *frags = scratch->frags, *ret = NULL;
+    gcstring_t *str, *urgent, *empty = scratch->empty;
+    size_t done = 0, i, j, k, spc;
+    double cols;
+
+    if (obj->urgent_func == NULL || obj->colmax <= 0.0)
+	return 1;
+
+    for (i = 0; i < frags->len; i++) {
+	if (frags->spc[i] - frags->beg[i] < 2)
+	    continue;
+	str = urgent = NULL;
+	if (obj->charmax &&
+	    obj->charmax < layout_chars(frags, frags->beg[i], frags->spc[i]))
+	    cols = obj->colmax + 1.0;
+	else if (0.0 <= frags->cols[i])
+	    cols = frags->cols[i];
+	else {
+	    str = layout_scratch_hold(scratch, layout_str(frags, i));
+	    cols = layout_sizing(obj, 0.0, empty, empty, str);
+	}
+	if (!obj->errnum && obj->colmax < cols) {
+	    if (str == NULL)
+		str = layout_scratch_hold(scratch, layout_str(frags, i));
+	    urgent = (*obj->urgent_func)(obj, str);
+	}
+	layout_scratch_hold(scratch, urgent);
+	if (obj->errnum)
+	    return 0;
+	if (urgent == NULL || urgent->gclen == 0)
+	    continue;
+
+	if (ret == NULL)
+	    ret = scratch->work = layout_new_fragments(obj);
+	layout_copy(ret, frags, done, i);
+	for (j = 0, k = 1; k <= urgent->gclen; k++) {
+	    if (k < urgent->gclen &&
+		!(urgent->gcstr[k].flag & LINEBREAK_FLAG_ALLOW_BEFORE))
+		continue;
+	    layout_concat(ret, urgent, j, k);
+	    spc = ret->nclusters;
+	    if (k < urgent->gclen)
+		layout_push(ret, spc, LAYOUT_BREAK_URGENT);
+	    else {
+		layout_concat_text(ret, frags, frags->spc[i],
+				   frags->beg[i + 1]);
+		layout_push(ret, spc, frags->brk[i]);
+	    }
+	    layout_measure(obj, ret, ret->len - 1);
+	    j = k;
+	}
+	layout_scratch_hold(scratch, NULL);
+	done = i + 1;
+    }
+
+    if (ret != NULL)
+	layout_copy(ret, frags, done, frags->len);
+    return 1;
+}
+
+/*
+ * Columns of line consisting of fragments BEG..END, given columns COLS of
+ * BEG..END-1.  PRE is text of BEG..END-1 which is required only when
+ * sizes are not cached.
+ */
+static
+double layout_columns(linebreak_t *obj, fragments_t *frags, size_t beg,
+		      size_t end, double cols, gcstring_t *pre,
+		      gcstring_t *empty)
+{
+    gcstring_t *str, *spc;
+
+    if (0.0 <= frags->cols[end]) {
+	if (beg == end)
+	    return frags->cols[end];
+	return cols + frags->spccols[end - 1] + frags->cols[end];
+    }
+    str = layout_str(frags, end);
+    if (beg == end)
+	cols = layout_sizing(obj, 0.0, pre, empty, str);
+    else {
+	spc = layout_spc(frags, end - 1);
+	cols = layout_sizing(obj, cols, pre, spc, str);
+	gcstring_destroy(spc);
+    }
+    gcstring_destroy(str);
+    return cols;
+}
+
+static
+void layout_append(gcstring_t *pre, fragments_t *frags, size_t beg,
+		   size_t end)
+{
+    gcstring_t *s;
+
+    if (pre == NULL || 0.0 <= frags->cols[end])
+	return;
+    if (beg < end)
+	s = layout_substr(frags, frags->spc[end - 1],
+			  frags->spc[end] - frags->spc[end - 1]);
+    else
+	s = layout_str(frags, end);
+    gcstring_append(pre, s);
+    gcstring_destroy(s);
+}
+
+#define LAYOUT_OVERFLOW(obj, cols, chars) \
+    ((0.0 < (obj)->colmax && (obj)->colmax < (cols)) || \
+     ((obj)->charmax && (obj)->charmax < (chars)))
+
+/*
+ * Push line laid out greedily.  Text of line is taken from pre member of
+ * SCRATCH and is formatted with SPACEs SPC only if FORMAT is true.  SPC,
+ * which may be NULL, is consumed.  Returns false on error.
+ */
+static
+int layout_greedy_push(linebreak_t *obj, layout_scratch_t *scratch,
+		       double cols, gcstring_t *spc, linebreak_state_t state,
+		       int format)
+{
+    size_t n = scratch->nlines;
+    gcstring_t *line, *t;
+
+    if (scratch->siz <= n + 1) {
+	scratch->siz = scratch->siz ? scratch->siz * 2 : 64;
+	LAYOUT_GROW(scratch->cols, scratch->siz);
+	if (format)
+	    LAYOUT_GROW(scratch->lines, scratch->siz);
+    }
+    scratch->cols[n] = cols;
+    scratch->nlines = n + 1;
+    if (!format) {
+	layout_scratch_unpre(scratch);
+	if (spc != NULL)
+	    gcstring_destroy(spc);
+	return 1;
+    }
+
+    scratch->lines[n + 1] = NULL;
+    line = scratch->lines[n] = scratch->pre;
+    scratch->pre = NULL;
+    if (spc == NULL && (spc = gcstring_new(NULL, obj)) == NULL)
+	croak("layout_greedy_push: %s", strerror(errno));
+    if ((line = scratch->lines[n] =
+	 layout_format(obj, LINEBREAK_STATE_LINE, line)) == NULL) {
+	gcstring_destroy(spc);
+	return 0;
+    }
+    if ((t = layout_format(obj, state, spc)) == NULL)
+	return 0;
+    gcstring_append(line, t);
+    gcstring_destroy(t);
+    return 1;
+}
+
+/*
+ * Break line held as pre member of SCRATCH by urgent breaking function.
+ * Pieces but the last are pushed as lines, and the last one, formatted as
+ * start of line, is held instead.  Columns of it are stored into COLSP.
+ * Returns false on error.
+ */
+static
+int layout_greedy_urgent(linebreak_t *obj, layout_scratch_t *scratch,
+			 double *colsp, int format)
+{
+    gcstring_t *urgent, *piece;
+    size_t j, k;
+
+    if (obj->urgent_func == NULL || scratch->pre->gclen < 2)
+	return 1;
+    urgent = layout_scratch_hold(scratch,
+				 (*obj->urgent_func)(obj, scratch->pre));
+    if (obj->errnum)
+	return 0;
+    if (urgent == NULL || urgent->gclen == 0)
+	return 1;
+
+    for (j = 0, k = 1; k <= urgent->gclen; k++) {
+	if (k < urgent->gclen &&
+	    !(urgent->gcstr[k].flag & LINEBREAK_FLAG_ALLOW_BEFORE))
+	    continue;
+	if ((piece = gcstring_substr(urgent, j, k - j)) == NULL)
+	    croak("layout_greedy_urgent: %s", strerror(errno));
+	layout_scratch_unpre(scratch);
+	scratch->pre = piece;
+	if (0 < j && format &&
+	    (scratch->pre = layout_format(obj, LINEBREAK_STATE_SOL, piece))
+	    == NULL)
+	    return 0;
+	if (k < urgent->gclen) {
+	    *colsp = layout_sizing(obj, 0.0, scratch->empty, scratch->empty,
+				   scratch->pre);
+	    if (obj->errnum ||
+		!layout_greedy_push(obj, scratch, *colsp, NULL,
+				    LINEBREAK_STATE_EOL, format))
+		return 0;
+	} else if (0 < j)
+	    *colsp = layout_sizing(obj, 0.0, scratch->empty, scratch->empty,
+				   scratch->pre);
+	j = k;
+    }
+    layout_scratch_hold(scratch, NULL);
+    return !obj->errnum;
+}
 
-    dSP;
-    if (action <= LINEBREAK_STATE_NONE || LINEBREAK_STATE_MAX <= action)
+/*
+ * Fit fragments into lines greedily in the same way as linebreak_break():
+ * Line narrower than ColMin is not broken before overflowing fragment but
+ * is broken by urgent breaking function, and text formatted at start of
+ * line is measured again.  Lines are formatted only if FORMAT is true.
+ * Returns number of lines, or -1 on error.
+ */
+static
+SSize_t layout_greedy(linebreak_t *obj, layout_scratch_t *scratch, int format)
+{
+    fragments_t *frags = scratch->frags;
+    gcstring_t *empty = scratch->empty, *t;
+    size_t len = frags->len, f, chars = 0, newchars;
+    double cols = 0.0, newcols;
+    linebreak_state_t state = LINEBREAK_STATE_SOT;
+    int keep, open = 0;
+
+    /* Text of line is kept unless only columns are needed. */
+    keep = format || obj->urgent_func != NULL ||
+	(len && frags->cols[0] < 0.0);
+
+    obj->errnum = 0;
+    for (f = 0; f < len; f++) {
+	if (open) {
+	    newcols = layout_columns(obj, frags, f - 1, f, cols, scratch->pre,
+				     empty);
+	    if (obj->errnum)
+		break;
+	    newchars = chars +
+		layout_chars(frags, frags->spc[f - 1], frags->spc[f]);
+	    if (LAYOUT_OVERFLOW(obj, newcols, newchars) &&
+		obj->colmin <= cols) {
+		if (!layout_greedy_push(obj, scratch, cols,
+					format ? layout_spc(frags, f - 1) :
+					NULL, LINEBREAK_STATE_EOL, format))
+		    break;
+		state = LINEBREAK_STATE_SOL;
+		open = 0;
+	    } else {
+		if (keep) {
+		    t = layout_substr(frags, frags->spc[f - 1],
+				      frags->spc[f] - frags->spc[f - 1]);
+		    gcstring_append(scratch->pre, t);
+		    gcstring_destroy(t);
+		}
+		cols = newcols;
+		chars = newchars;
+		if (LAYOUT_OVERFLOW(obj, cols, chars)) {
+		    if (!layout_greedy_urgent(obj, scratch, &cols, format))
+			break;
+		    if (keep)
+			chars = scratch->pre->len;
+		}
+	    }
+	}
+
+	if (!open) {
+	    cols = frags->cols[f];
+	    chars = layout_chars(frags, frags->beg[f], frags->spc[f]);
+	    if (keep) {
+		layout_scratch_unpre(scratch);
+		scratch->pre = layout_str(frags, f);
+	    }
+	    if (format && obj->format_func != NULL) {
+		t = (*obj->format_func)(obj, state, scratch->pre);
+		if (obj->errnum) {
+		    if (t != NULL)
+			gcstring_destroy(t);
+		    break;
+		}
+		if (t != NULL) {
+		    layout_scratch_unpre(scratch);
+		    scratch->pre = t;
+		    cols = -1.0;
+		    chars = t->len;
+		}
+	    }
+	    if (cols < 0.0)
+		cols = layout_sizing(obj, 0.0, empty, empty, scratch->pre);
+	    if (obj->errnum)
+		break;
+	    open = 1;
+	    if (LAYOUT_OVERFLOW(obj, cols, chars)) {
+		if (!layout_greedy_urgent(obj, scratch, &cols, format))
+		    break;
+		if (keep)
+		    chars = scratch->pre->len;
+	    }
+	}
+
+	if (f + 1 == len || frags->brk[f] == LAYOUT_BREAK_MANDATORY) {
+	    if (!layout_greedy_push(obj, scratch, cols,
+				    format ? layout_spc(frags, f) : NULL,
+				    (f + 1 == len) ? LINEBREAK_STATE_EOT :
+				    LINEBREAK_STATE_EOP, format))
+		break;
+	    state = LINEBREAK_STATE_SOP;
+	    open = 0;
+	}
+    }
+    return obj->errnum ? -1 : (SSize_t)scratch->nlines;
+}
+
+static
+SSize_t layout_fit_optimal(linebreak_t *obj, fragments_t *frags,
+			   layout_scratch_t *scratch)
+{
+    gcstring_t *pre = NULL, *empty = scratch->empty;
+    size_t len = frags->len, nlines, i, j, k, chars, *prev;
+    double *best, cols = 0.0, b, d, e;
+    int fit, c, join;
+
+    if ((best = scratch->best =
+	 malloc(sizeof(double) * LAYOUT_FITNESS * (len + 1))) == NULL ||
+	(prev = scratch->prev =
+	 malloc(sizeof(size_t) * LAYOUT_FITNESS * (len + 1))) == NULL)
+	croak("layout_fit_optimal: %s", strerror(errno));
+    /* best[LAYOUT_FITNESS * j + c] is total demerits of lines up to j-th
+     * fragment, the last of which is of fitness class c; and prev[] is
+     * the state where the last line begins. */
+    for (k = 0; k < LAYOUT_FITNESS * (len + 1); k++)
+	best[k] = -1.0;
+    best[LAYOUT_FITNESS - 1] = 0.0;
+
+    /* Lines consisting of fragments i..j. */
+    for (i = 0; i < len; i++) {
+	pre = (frags->cols[i] < 0.0) ? layout_scratch_pre(scratch, obj) :
+	    NULL;
+	/* Whether demerits between lines are counted. */
+	join = (0 < i && frags->brk[i - 1] != LAYOUT_BREAK_MANDATORY);
+	for (j = i; j < len; j++) {
+	    cols = layout_columns(obj, frags, i, j, cols, pre, empty);
+	    if (obj->errnum)
+		break;
+	    chars = layout_chars(frags, frags->beg[i], frags->spc[j]);
+	    if (i < j &&
+		(obj->colmax < cols ||
+		 (obj->charmax && obj->charmax < chars)))
+		break;
+
+	    if (obj->colmax < cols)
+		b = LAYOUT_AWFUL_BAD;
+	    else if (j + 1 == len || frags->brk[j] == LAYOUT_BREAK_MANDATORY)
+		b = 0.0;
+	    else if (cols < obj->colmin)
+		b = LAYOUT_AWFUL_BAD;
+	    else {
+		b = (obj->colmax - cols) / obj->colmax;
+		b = 100.0 * b * b * b;
+	    }
+	    fit = LAYOUT_FITNESS_OF(b);
+	    d = (LAYOUT_LINE_PENALTY + b) * (LAYOUT_LINE_PENALTY + b);
+	    if (frags->brk[j] == LAYOUT_BREAK_URGENT)
+		d += LAYOUT_URGENT_PENALTY * LAYOUT_URGENT_PENALTY;
+
+	    for (c = 0; c < LAYOUT_FITNESS; c++) {
+		if (best[LAYOUT_FITNESS * i + c] < 0.0)
+		    continue;
+		e = d;
+		if (join) {
+		    if (1 < abs(c - fit))
+			e += LAYOUT_ADJ_DEMERITS;
+		    if (frags->brk[i - 1] == LAYOUT_BREAK_URGENT &&
+			frags->brk[j] == LAYOUT_BREAK_URGENT)
+			e += LAYOUT_DOUBLE_URGENT_DEMERITS;
+		}
+		e += best[LAYOUT_FITNESS * i + c];
+		k = LAYOUT_FITNESS * (j + 1) + fit;
+		if (best[k] < 0.0 || e < best[k]) {
+		    best[k] = e;
+		    prev[k] = LAYOUT_FITNESS * i + c;
+		}
+	    }
+
+	    if (frags->brk[j] == LAYOUT_BREAK_MANDATORY)
+		break;
+	    layout_append(pre, frags, i, j);
+	}
+	layout_scratch_unpre(scratch);
+	if (obj->errnum)
+	    break;
+    }
+
+    /* Trace back from the best state at the end. */
+    nlines = 0;
+    if (!obj->errnum && 0 < len) {
+	for (k = LAYOUT_FITNESS * len, c = 1; c < LAYOUT_FITNESS; c++)
+	    if (best[k] < 0.0 ||
+		(0.0 <= best[LAYOUT_FITNESS * len + c] &&
+		 best[LAYOUT_FITNESS * len + c] < best[k]))
+		k = LAYOUT_FITNESS * len + c;
+	for (j = k; LAYOUT_FITNESS <= j; j = prev[j])
+	    nlines++;
+	for (i = nlines, j = k; LAYOUT_FITNESS <= j; j = prev[j])
+	    scratch->ends[--i] = j / LAYOUT_FITNESS;
+    }
+    return obj->errnum ? -1 : (SSize_t)nlines;
+}
+
+/*
+ * Break oversize fragments then fit them into lines optimally.  Fragments
+ * to be laid out and end positions of lines are stored into work and ends
+ * members of SCRATCH.  Returns number of lines, or -1 on error.
+ */
+static
+SSize_t layout_fit(linebreak_t *obj, layout_scratch_t *scratch)
+{
+    fragments_t *work;
+
+    obj->errnum = 0;
+    if (!layout_urgent(obj, scratch))
+	return -1;
+    work = scratch->work;
+    if ((scratch->ends = malloc(sizeof(size_t) * (work->len + 1))) == NULL)
+	croak("layout_fit: %s", strerror(errno));
+    return layout_fit_optimal(obj, work, scratch);
+}
+
+/* Whether optimal-fit layout is used. */
+#define LAYOUT_OPTIMAL(obj) \
+    ((obj)->options & LINEBREAK_OPTION_OPTIMAL_LAYOUT && 0.0 < (obj)->colmax)
+
+/*
+ * Lay out fragments and format lines.  Result is the same as
+ * linebreak_break().
+ */
+static
+gcstring_t **layout_break(linebreak_t *obj, fragments_t *frags)
+{
+    dTHX;
+    layout_scratch_t *scratch;
+    fragments_t *work;
+    size_t i, beg, end;
+    SSize_t nlines;
+    gcstring_t **ret, *line, *t;
+    linebreak_state_t state;
+
+    ENTER;
+    scratch = layout_scratch_new(aTHX_ obj, frags);
+    if (!LAYOUT_OPTIMAL(obj)) {
+	if (layout_greedy(obj, scratch, 1) < 0)
+	    ret = NULL; /* freed by LEAVE */
+	else {
+	    if ((ret = scratch->lines) == NULL &&
+		(ret = calloc(1, sizeof(gcstring_t *))) == NULL)
+		croak("layout_break: %s", strerror(errno));
+	    scratch->lines = NULL;
+	}
+	LEAVE;
+	return ret;
+    }
+    if ((nlines = layout_fit(obj, scratch)) < 0) {
+	LEAVE;
 	return NULL;
-    actionstr = linebreak_states[(size_t)action];
+    }
+    work = scratch->work;
+
+    if ((ret = scratch->lines =
+	 malloc(sizeof(gcstring_t *) * (nlines + 1))) == NULL)
+	croak("layout_break: %s", strerror(errno));
+    for (i = 0; i <= (size_t)nlines; i++)
+	ret[i] = NULL;
+
+    /* Format lines. */
+    for (i = 0, beg = 0; i < (size_t)nlines; i++, beg = end) {
+	end = scratch->ends[i];
+
+	if (beg == 0)
+	    state = LINEBREAK_STATE_SOT;
+	else if (work->brk[beg - 1] == LAYOUT_BREAK_MANDATORY)
+	    state = LINEBREAK_STATE_SOP;
+	else
+	    state = LINEBREAK_STATE_SOL;
+	if ((line = layout_format(obj, state, layout_str(work, beg))) == NULL)
+	    break;
+	ret[i] = line;
+	if (beg + 1 < end) {
+	    t = layout_substr(work, work->spc[beg],
+			      work->spc[end - 1] - work->spc[beg]);
+	    gcstring_append(line, t);
+	    gcstring_destroy(t);
+	}
+	if ((line = ret[i] = layout_format(obj, LINEBREAK_STATE_LINE, line))
+	    == NULL)
+	    break;
+
+	if (end == work->len)
+	    state = LINEBREAK_STATE_EOT;
+	else if (work->brk[end - 1] == LAYOUT_BREAK_MANDATORY)
+	    state = LINEBREAK_STATE_EOP;
+	else
+	    state = LINEBREAK_STATE_EOL;
+	if ((t = layout_format(obj, state, layout_spc(work, end - 1))) == NULL)
+	    break;
+	gcstring_append(line, t);
+	gcstring_destroy(t);
+    }
+
+    if (i < (size_t)nlines)
+	ret = NULL; /* freed by LEAVE */
+    else
+	scratch->lines = NULL;
+    LEAVE;
+    return ret;
+}
+
+/*
+ * Lay out fragments and measure lines without formatting them.  Columns
+ * of each line not counting trailing SPACEs are stored into COLSP.
+ * Returns number of lines, or -1 on error.
+ */
+static
+SSize_t layout_measure_lines(linebreak_t *obj, fragments_t *frags,
+			     double **colsp)
+{
+    dTHX;
+    layout_scratch_t *scratch;
+    fragments_t *work;
+    size_t i, beg, end, j;
+    SSize_t nlines;
+    gcstring_t *pre;
+    double *cols;
+
     ENTER;
-    SAVETMPS;
-    PUSHMARK(SP);
-    linebreak_incref(lbobj); /* mortal but should not be destroyed. */
-    XPUSHs(sv_2mortal(CtoPerl("Unicode::LineBreak", lbobj)));
-    XPUSHs(sv_2mortal(newSVpv(actionstr, 0)));
-    XPUSHs(sv_2mortal(CtoPerl("Unicode::GCString", gcstring_copy(str))));
-    PUTBACK;
-    count = call_sv(lbobj->format_data, G_SCALAR | G_EVAL);
+    scratch = layout_scratch_new(aTHX_ obj, frags);
+    if (!LAYOUT_OPTIMAL(obj)) {
+	if ((nlines = layout_greedy(obj, scratch, 0)) < 0) {
+	    LEAVE;
+	    return -1;
+	}
+	if ((*colsp = scratch->cols) == NULL &&
+	    (*colsp = malloc(sizeof(double))) == NULL)
+	    croak("layout_measure_lines: %s", strerror(errno));
+	scratch->cols = NULL;
+	LEAVE;
+	return nlines;
+    }
+    if ((nlines = layout_fit(obj, scratch)) < 0) {
+	LEAVE;
+	return -1;
+    }
+    work = scratch->work;
+    if ((cols = scratch->cols = malloc(sizeof(double) * (nlines + 1)))
+	== NULL)
+	croak("layout_measure_lines: %s", strerror(errno));
+
+    for (i = 0, beg = 0; i < (size_t)nlines; i++, beg = end) {
+	end = scratch->ends[i];
+	pre = (work->cols[beg] < 0.0) ? layout_scratch_pre(scratch, obj) :
+	    NULL;
+	cols[i] = 0.0;
+	for (j = beg; j < end && !obj->errnum; j++) {
+	    cols[i] = layout_columns(obj, work, beg, j, cols[i], pre,
+				     scratch->empty);
+	    layout_append(pre, work, beg, j);
+	}
+	layout_scratch_unpre(scratch);
+	if (obj->errnum)
+	    break;
+    }
 
-    SPAGAIN;
-    if (SvTRUE(ERRSV)) {
-	if (!lbobj->errnum)
-	    lbobj->errnum = LINEBREAK_EEXTN;
-	POPs;
+    if (obj->errnum)
+	nlines = -1;
+    else {
+	*colsp = cols;
+	scratch->cols = NULL;
+    }
+    LEAVE;
+    return nlines;
+}
+
+/*
+ * Break text into lines by optimal-fit layout.
+ */
+static
+void layout_unwind_fragments(pTHX_ void *frags)
+{
+    layout_free_fragments((fragments_t *)frags);
+}
+
+static
+gcstring_t **optimal_break(linebreak_t *obj, unistr_t *input)
+{
+    dTHX;
+    fragments_t *frags;
+    gcstring_t **ret;
+
+    obj->errnum = 0;
+    if (obj->colmax <= 0.0)
+	return linebreak_break(obj, input);
+    if ((frags = layout_fragments(obj, input)) == NULL)
 	return NULL;
-    } else if (count != 1)
-	croak("format_func: internal error");
+    ENTER;
+    SAVEDESTRUCTOR_X(layout_unwind_fragments, frags);
+    ret = layout_break(obj, frags);
+    LEAVE;
+    return ret;
+}
+
+/*
+ * Prepared text.  If INPUT is NULL, fragments are left empty.
+ */
+static
+prepared_t *prepared_new(linebreak_t *obj, unistr_t *input)
+{
+    prepared_t *ret;
+
+    if ((ret = malloc(sizeof(prepared_t))) == NULL)
+	croak("prepared_new: %s", strerror(errno));
+    if ((ret->lbobj = lbobj_share(obj)) == NULL) {
+	free(ret);
+	croak("prepared_new: %s", strerror(errno));
+    }
+    ret->lbobj->options &= ~LINEBREAK_OPTION_FROZEN;
+    if (input == NULL)
+	ret->frags = layout_new_fragments(ret->lbobj);
+    else if ((ret->frags = layout_fragments(ret->lbobj, input)) == NULL) {
+	obj->errnum = ret->lbobj->errnum;
+	lbobj_destroy(ret->lbobj);
+	free(ret);
+	return NULL;
+    }
+    ret->colmax = ret->lbobj->colmax;
+    ret->colmin = ret->lbobj->colmin;
+    ret->charmax = ret->lbobj->charmax;
+    ret->options = ret->lbobj->options;
+    return ret;
+}
+
+/*
+ * Restore configuration of prepared text then override it by options
+ * given as ARGS.
+ */
+static
+linebreak_t *prepared_config(prepared_t *prep, SV **args, size_t nargs,
+			     char *func)
+{
+    linebreak_t *obj = prep->lbobj;
+    size_t i;
+    char *key, *opt;
+    SV *val;
+
+    if (nargs % 2)
+	croak("%s: Argument size mismatch", func);
+    obj->colmax = prep->colmax;
+    obj->colmin = prep->colmin;
+    obj->charmax = prep->charmax;
+    obj->options = prep->options;
+    for (i = 0; i < nargs; i += 2) {
+	key = (char *)SvPV_nolen(args[i]);
+	val = args[i + 1];
+
+	if (strcasecmp(key, "CharMax") == 0)
+	    obj->charmax = SvUV(val);
+	else if (strcasecmp(key, "ColMax") == 0)
+	    obj->colmax = (double)SvNV(val);
+	else if (strcasecmp(key, "ColMin") == 0)
+	    obj->colmin = (double)SvNV(val);
+	else if (strcasecmp(key, "Layout") == 0) {
+	    if (SvOK(val))
+		opt = (char *)SvPV_nolen(val);
+	    else
+		opt = "GREEDY";
+	    if (strcasecmp(opt, "OPTIMAL") == 0)
+		obj->options |= LINEBREAK_OPTION_OPTIMAL_LAYOUT;
+	    else if (strcasecmp(opt, "GREEDY") == 0)
+		obj->options &= ~LINEBREAK_OPTION_OPTIMAL_LAYOUT;
+	    else
+		croak("%s: Unknown Layout option: %s", func, opt);
+	} else
+	    croak("%s: Can't change option %s", func, key);
+    }
+    return obj;
+}
+
+static
+void prepared_destroy(prepared_t *prep)
+{
+    if (prep == NULL)
+	return;
+    layout_free_fragments(prep->frags);
+    lbobj_destroy(prep->lbobj);
+    free(prep);
+}
+
+/***
+ *** Bitmaps of breaking opportunities.
+ ***/
+
+/* New mortal bit string for LEN characters, zeroed. */
+static
+SV *bitmap_new(pTHX_ size_t len)
+{
+    SV *sv;
+    size_t n = (len + 7) / 8;
+
+    sv = sv_2mortal(newSV(n + 1));
+    SvPOK_only(sv);
+    memset(SvPVX(sv), 0, n + 1);
+    SvCUR_set(sv, n);
+    return sv;
+}
+
+/*
+ * Find breaking opportunities of INPUT.  Bit i of ALLOWED is set if line
+ * may be broken before i-th character and that of MANDATORY if it must
+ * be.  Each bitmap not NULL has (len + 7) / 8 bytes zeroed and bits are
+ * in the order of vec().  Breaking opportunities are the same as those
+ * layout finds, including user-defined breaking (Prep); neither sizing,
+ * formatting nor urgent breaking is performed.  Returns 0 on error.
+ */
+static
+int break_bitmap(pTHX_ linebreak_t *obj, unistr_t *input, U8 *allowed,
+		 U8 *mandatory)
+{
+    breaks_t *breaks;
+    gcstring_t *gcstr;
+    gcchar_t *gc;
+    size_t i;
+
+    ENTER;
+    if ((breaks = breaks_new(aTHX_ obj, input)) == NULL) {
+	LEAVE;
+	return 0;
+    }
+    gcstr = breaks->gcstr;
+
+    for (i = 0; i < gcstr->gclen; i++) {
+	gc = gcstr->gcstr + i;
+	/* Prep might have changed length of text. */
+	if (input->len <= gc->idx)
+	    break;
+
+	switch (breaks->action[i]) {
+	case LINEBREAK_ACTION_MANDATORY:
+	    if (mandatory != NULL)
+		mandatory[gc->idx >> 3] |= 1 << (gc->idx & 7);
+	    /* FALLTHROUGH */
+	case LINEBREAK_ACTION_DIRECT:
+	    if (allowed != NULL)
+		allowed[gc->idx >> 3] |= 1 << (gc->idx & 7);
+	    break;
+	default:
+	    break;
+	}
+    }
+
+    LEAVE;
+    return 1;
+}
+
+/***
+ *** Compiled profiles.
+ ***/
+
+/*
+ * Compiled profile is a file containing configuration and tailoring map
+ * of linebreak object.  It has no pointers thus may be mapped anywhere,
+ * but its layout depends on platform and version of sombok library.
+ */
+#define PROFILE_MAGIC "LBPROF\r\n"
+#define PROFILE_VERSION (1)
+#define PROFILE_BYTEORDER (0x01020304UL)
+#define PROFILE_PREPMAX (8)
+#define PROFILE_ALIGN(n) (((n) + 15) & ~((size_t)15))
+
+typedef struct {
+    char magic[8];
+    U32 byteorder;
+    U32 version;
+    U32 hdrsize;
+    U32 entsize;
+    char sombok_version[16];
+    U32 options;
+    U32 format;
+    U32 sizing;
+    U32 urgent;
+    U32 nprep;
+    U32 prep[PROFILE_PREPMAX];
+    double colmax;
+    double colmin;
+    size_t charmax;
+    size_t newline_off;
+    size_t newline_len;
+    size_t map_off;
+    size_t mapsiz;
+    size_t filelen;
+} profile_header_t;
+
+/* Codes of built-in methods. */
+#define PROFILE_FORMAT_SIMPLE (1)
+#define PROFILE_FORMAT_NEWLINE (2)
+#define PROFILE_FORMAT_TRIM (3)
+#define PROFILE_SIZING_UAX11 (1)
+#define PROFILE_URGENT_ABORT (1)
+#define PROFILE_URGENT_FORCE (2)
+#define PROFILE_PREP_BREAKURI (1)
+#define PROFILE_PREP_NONBREAKURI (2)
+
+/* Whether SIZ bytes at offset OFF lie within LEN bytes, without overflow. */
+#define PROFILE_INRANGE(off, siz, len) \
+    ((off) <= (len) && (siz) <= (len) - (off))
+
+static
+void profile_write(PerlIO *fp, const void *buf, size_t len, char *filename)
+{
+    if (len && PerlIO_write(fp, buf, len) != (SSize_t)len) {
+	int err = errno;
+	PerlIO_close(fp);
+	croak("compile: %s: %s", filename, strerror(err));
+    }
+}
+
+/*
+ * Write linebreak object to file.  Perl callbacks can not be compiled.
+ */
+static
+void profile_compile(linebreak_t *obj, char *filename)
+{
+    profile_header_t hdr;
+    PerlIO *fp;
+    size_t i;
+    static const char pad[16] = {0};
+
+    memset(&hdr, 0, sizeof(profile_header_t));
+    memcpy(hdr.magic, PROFILE_MAGIC, 8);
+    hdr.byteorder = PROFILE_BYTEORDER;
+    hdr.version = PROFILE_VERSION;
+    hdr.hdrsize = sizeof(profile_header_t);
+    hdr.entsize = sizeof(mapent_t);
+    strncpy(hdr.sombok_version, SOMBOK_VERSION, 15);
+    hdr.options = obj->options & ~LINEBREAK_OPTION_FROZEN;
+    hdr.colmax = obj->colmax;
+    hdr.colmin = obj->colmin;
+    hdr.charmax = obj->charmax;
+
+    if (obj->format_func == NULL)
+	hdr.format = 0;
+    else if (obj->format_func == linebreak_format_SIMPLE)
+	hdr.format = PROFILE_FORMAT_SIMPLE;
+    else if (obj->format_func == linebreak_format_NEWLINE)
+	hdr.format = PROFILE_FORMAT_NEWLINE;
+    else if (obj->format_func == linebreak_format_TRIM)
+	hdr.format = PROFILE_FORMAT_TRIM;
     else
-	sv = POPs;
-    if (!SvOK(sv))
-	ret = NULL;
+	croak("compile: Can't compile Format option of subroutine");
+    if (obj->sizing_func == NULL)
+	hdr.sizing = 0;
+    else if (obj->sizing_func == linebreak_sizing_UAX11)
+	hdr.sizing = PROFILE_SIZING_UAX11;
     else
-	ret = SVtogcstring(sv, lbobj);
-    if (sv_isobject(sv))
-	ret = gcstring_copy(ret);
+	croak("compile: Can't compile Sizing option of subroutine");
+    if (obj->urgent_func == NULL)
+	hdr.urgent = 0;
+    else if (obj->urgent_func == linebreak_urgent_ABORT)
+	hdr.urgent = PROFILE_URGENT_ABORT;
+    else if (obj->urgent_func == linebreak_urgent_FORCE)
+	hdr.urgent = PROFILE_URGENT_FORCE;
+    else
+	croak("compile: Can't compile Urgent option of subroutine");
+    if (obj->prep_func != NULL)
+	for (i = 0; obj->prep_func[i] != NULL; i++) {
+	    if (obj->prep_func[i] != linebreak_prep_URIBREAK)
+		croak("compile: Can't compile Prep option of regex");
+	    if (PROFILE_PREPMAX <= i)
+		croak("compile: Too many Prep options");
+	    if (obj->prep_data == NULL || obj->prep_data[i] == NULL)
+		hdr.prep[i] = PROFILE_PREP_NONBREAKURI;
+	    else
+		hdr.prep[i] = PROFILE_PREP_BREAKURI;
+	    hdr.nprep = i + 1;
+	}
+
+    hdr.newline_off = PROFILE_ALIGN(sizeof(profile_header_t));
+    hdr.newline_len = (obj->newline.str == NULL) ? 0 : obj->newline.len;
+    hdr.map_off = PROFILE_ALIGN(hdr.newline_off +
+				sizeof(unichar_t) * hdr.newline_len);
+    hdr.mapsiz = (obj->map == NULL) ? 0 : obj->mapsiz;
+    hdr.filelen = hdr.map_off + sizeof(mapent_t) * hdr.mapsiz;
+
+    if ((fp = PerlIO_open(filename, "wb")) == NULL)
+	croak("compile: %s: %s", filename, strerror(errno));
+    profile_write(fp, &hdr, sizeof(profile_header_t), filename);
+    profile_write(fp, pad, hdr.newline_off - sizeof(profile_header_t),
+		  filename);
+    profile_write(fp, obj->newline.str, sizeof(unichar_t) * hdr.newline_len,
+		  filename);
+    profile_write(fp, pad, hdr.map_off - hdr.newline_off -
+		  sizeof(unichar_t) * hdr.newline_len, filename);
+    profile_write(fp, obj->map, sizeof(mapent_t) * hdr.mapsiz, filename);
+    if (PerlIO_close(fp) != 0)
+	croak("compile: %s: %s", filename, strerror(errno));
+}
+
+/*
+ * Create frozen linebreak object from file.  Tailoring map is mapped
+ * read-only and shared by processes, if possible.
+ */
+static
+linebreak_t *profile_load(char *filename)
+{
+    PerlIO *fp;
+    Stat_t st;
+    char *buf = NULL, *err = NULL;
+    size_t len, i;
+    int mapped = 0;
+    profile_header_t *hdr;
+    linebreak_t *obj;
+    unistr_t newline;
+    SV *sv;
+
+    if ((fp = PerlIO_open(filename, "rb")) == NULL)
+	croak("load: %s: %s", filename, strerror(errno));
+    if (PerlLIO_fstat(PerlIO_fileno(fp), &st) != 0) {
+	int e = errno;
+	PerlIO_close(fp);
+	croak("load: %s: %s", filename, strerror(e));
+    }
+    if ((len = st.st_size) < sizeof(profile_header_t)) {
+	PerlIO_close(fp);
+	croak("load: %s: Not a compiled profile", filename);
+    }
+#ifdef HAS_MMAP
+    if ((buf = mmap(NULL, len, PROT_READ, MAP_SHARED, PerlIO_fileno(fp), 0))
+	== MAP_FAILED)
+	buf = NULL;
+    else
+	mapped = 1;
+#endif /* HAS_MMAP */
+    if (buf == NULL) {
+	if ((buf = malloc(len)) == NULL) {
+	    PerlIO_close(fp);
+	    croak("load: %s", strerror(errno));
+	}
+	if (PerlIO_read(fp, buf, len) != (SSize_t)len) {
+	    free(buf);
+	    PerlIO_close(fp);
+	    croak("load: %s: Can't read", filename);
+	}
+    }
+    PerlIO_close(fp);
+
+    hdr = (profile_header_t *)(void *)buf;
+    if (memcmp(hdr->magic, PROFILE_MAGIC, 8) != 0)
+	err = "Not a compiled profile";
+    else if (hdr->byteorder != PROFILE_BYTEORDER ||
+	     hdr->version != PROFILE_VERSION ||
+	     hdr->hdrsize != sizeof(profile_header_t) ||
+	     hdr->entsize != sizeof(mapent_t))
+	err = "Compiled on incompatible platform or by incompatible version";
+    else if (strncmp(hdr->sombok_version, SOMBOK_VERSION, 16) != 0)
+	err = "Compiled by another version of sombok";
+    else if (hdr->filelen != len || hdr->nprep > PROFILE_PREPMAX ||
+	     hdr->newline_off % sizeof(unichar_t) != 0 ||
+	     hdr->map_off % sizeof(unichar_t) != 0 ||
+	     len / sizeof(unichar_t) < hdr->newline_len ||
+	     !PROFILE_INRANGE(hdr->newline_off,
+			      sizeof(unichar_t) * hdr->newline_len, len) ||
+	     len / sizeof(mapent_t) < hdr->mapsiz ||
+	     !PROFILE_INRANGE(hdr->map_off, sizeof(mapent_t) * hdr->mapsiz,
+			      len))
+	err = "Broken profile";
+    if (err != NULL) {
+#ifdef HAS_MMAP
+	if (mapped)
+	    munmap(buf, len);
+	else
+#endif /* HAS_MMAP */
+	    free(buf);
+	croak("load: %s: %s", filename, err);
+    }
+
+    if ((obj = linebreak_new(ref_func)) == NULL) {
+	int e = errno;
+#ifdef HAS_MMAP
+	if (mapped)
+	    munmap(buf, len);
+	else
+#endif /* HAS_MMAP */
+	    free(buf);
+	croak("load: %s", strerror(e));
+    }
+    linebreak_set_stash(obj, newRV_noinc((SV *)newHV()));
+    SvREFCNT_dec(obj->stash); /* fixup */
+
+    obj->options = hdr->options | LINEBREAK_OPTION_FROZEN;
+    obj->colmax = hdr->colmax;
+    obj->colmin = hdr->colmin;
+    obj->charmax = hdr->charmax;
+    switch (hdr->format) {
+    case PROFILE_FORMAT_SIMPLE:
+	linebreak_set_format(obj, linebreak_format_SIMPLE, NULL);
+	break;
+    case PROFILE_FORMAT_NEWLINE:
+	linebreak_set_format(obj, linebreak_format_NEWLINE, NULL);
+	break;
+    case PROFILE_FORMAT_TRIM:
+	linebreak_set_format(obj, linebreak_format_TRIM, NULL);
+	break;
+    }
+    if (hdr->sizing == PROFILE_SIZING_UAX11)
+	linebreak_set_sizing(obj, linebreak_sizing_UAX11, NULL);
+    switch (hdr->urgent) {
+    case PROFILE_URGENT_ABORT:
+	linebreak_set_urgent(obj, linebreak_urgent_ABORT, NULL);
+	break;
+    case PROFILE_URGENT_FORCE:
+	linebreak_set_urgent(obj, linebreak_urgent_FORCE, NULL);
+	break;
+    }
+    for (i = 0; i < hdr->nprep; i++)
+	if (hdr->prep[i] == PROFILE_PREP_BREAKURI) {
+	    sv = newSVpvn("BREAKURI", 8);
+	    linebreak_add_prep(obj, linebreak_prep_URIBREAK, sv);
+	    SvREFCNT_dec(sv); /* fixup */
+	} else
+	    linebreak_add_prep(obj, linebreak_prep_URIBREAK, NULL);
+    newline.str = (unichar_t *)(void *)(buf + hdr->newline_off);
+    newline.len = hdr->newline_len;
+    linebreak_set_newline(obj, &newline);
+
+    if (hdr->mapsiz == 0)
+	;
+    else if (mapped) {
+	obj->map = (mapent_t *)(void *)(buf + hdr->map_off);
+	obj->mapsiz = hdr->mapsiz;
+	sharedbuf_map(obj->map, buf, len);
+	return obj;
+    } else if ((obj->map = malloc(sizeof(mapent_t) * hdr->mapsiz)) == NULL) {
+	free(buf);
+	lbobj_destroy(obj);
+	croak("load: %s", strerror(errno));
+    } else {
+	memcpy(obj->map, buf + hdr->map_off, sizeof(mapent_t) * hdr->mapsiz);
+	obj->mapsiz = hdr->mapsiz;
+    }
+#ifdef HAS_MMAP
+    if (mapped)
+	munmap(buf, len);
+    else
+#endif /* HAS_MMAP */
+	free(buf);
+    return obj;
+}
+
+/***
+ *** Break indexes.
+ ***/
+
+/*
+ * Break index is a file keeping breaking opportunities and grapheme
+ * clusters of a text so that the text may be laid out later without
+ * analysis.  Following the header, there are four sections:
+ *
+ *   breaks    For each fragment, varints of number of clusters of text
+ *             and of (number of clusters of SPACEs and newline << 1 |
+ *             1 if break after the fragment is mandatory).
+ *   clusters  Varints of lengths of clusters.
+ *   classes   Line breaking classes of clusters, then extended classes
+ *             and flags, a byte for each.
+ *   widths    Columns of clusters, a byte for each.
+ *
+ * Header records version of Unicode, hash of options affecting analysis
+ * and hash of the text so that stale indexes will be detected.
+ */
+#define INDEX_MAGIC "LBINDEX\n"
+#define INDEX_VERSION (1)
+#define INDEX_FNV_BASIS (2166136261UL)
+#define INDEX_FNV_PRIME (16777619UL)
+#define INDEX_INRANGE(off, siz, len) \
+    ((off) <= (len) && (siz) <= (len) - (off))
+
+typedef struct {
+    char magic[8];
+    U32 byteorder;
+    U32 version;
+    U32 hdrsize;
+    char unicode_version[16];
+    U32 config_hash;
+    U32 text_hash;
+    U32 textlen;
+    U32 nclusters;
+    U32 nfrags;
+    U32 breaks_off;
+    U32 breaks_len;
+    U32 clusters_off;
+    U32 clusters_len;
+    U32 classes_off;
+    U32 widths_off;
+    U32 filelen;
+} index_header_t;
+
+/* FNV-1a hash. */
+static
+U32 index_hash(U32 hash, const void *buf, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+
+    while (len--) {
+	hash ^= *p++;
+	hash *= INDEX_FNV_PRIME;
+    }
+    return hash;
+}
+
+/*
+ * Hash of options affecting breaking opportunities and properties of
+ * clusters.  Perl callbacks can not be hashed.
+ */
+static
+U32 index_config_hash(linebreak_t *obj, char *func)
+{
+    U32 hash = INDEX_FNV_BASIS, v;
+    unsigned char props[2];
+    size_t i;
+
+    v = obj->options &
+	~(LINEBREAK_OPTION_FROZEN | LINEBREAK_OPTION_OPTIMAL_LAYOUT);
+    hash = index_hash(hash, &v, sizeof(U32));
+    if (obj->prep_func != NULL)
+	for (i = 0; obj->prep_func[i] != NULL; i++) {
+	    if (obj->prep_func[i] != linebreak_prep_URIBREAK)
+		croak("%s: Can't index with Prep option of regex", func);
+	    if (obj->prep_data == NULL || obj->prep_data[i] == NULL)
+		v = PROFILE_PREP_NONBREAKURI;
+	    else
+		v = PROFILE_PREP_BREAKURI;
+	    hash = index_hash(hash, &v, sizeof(U32));
+	}
+    for (i = 0; obj->map != NULL && i < obj->mapsiz; i++) {
+	v = obj->map[i].beg;
+	hash = index_hash(hash, &v, sizeof(U32));
+	v = obj->map[i].end;
+	hash = index_hash(hash, &v, sizeof(U32));
+	props[0] = obj->map[i].lbc;
+	props[1] = obj->map[i].eaw;
+	hash = index_hash(hash, props, 2);
+    }
+    return hash;
+}
 
-    PUTBACK;
-    FREETMPS;
-    LEAVE;
+static
+void index_varint(SV *buf, size_t n)
+{
+    char b[16];
+    size_t i = 0;
 
-    return ret;
+    while (0x7F < n) {
+	b[i++] = (char)(0x80 | (n & 0x7F));
+	n >>= 7;
+    }
+    b[i++] = (char)n;
+    sv_catpvn(buf, b, i);
+}
+
+static
+int index_unvarint(const unsigned char **pp, const unsigned char *end,
+		   size_t *np)
+{
+    const unsigned char *p = *pp;
+    size_t n = 0, shift = 0;
+
+    while (p < end && shift < sizeof(size_t) * 8) {
+	n |= (size_t)(*p & 0x7F) << shift;
+	if (!(*p++ & 0x80)) {
+	    *pp = p;
+	    *np = n;
+	    return 1;
+	}
+	shift += 7;
+    }
+    return 0;
 }
 
 /*
- * Call sizing function
+ * Write index of prepared text INPUT to file.
  */
 static
-double sizing_func(linebreak_t *lbobj, double len,
-		   gcstring_t *pre, gcstring_t *spc, gcstring_t *str)
+void index_write(prepared_t *prep, unistr_t *input, char *filename)
 {
-    int count;
-    double ret;
-
-    dSP;
-    ENTER;
-    SAVETMPS;
-    PUSHMARK(SP);
-    linebreak_incref(lbobj); /* mortal but should not be destroyed. */
-    XPUSHs(sv_2mortal(CtoPerl("Unicode::LineBreak", lbobj)));
-    XPUSHs(sv_2mortal(newSVnv(len))); 
-    XPUSHs(sv_2mortal(CtoPerl("Unicode::GCString", gcstring_copy(pre))));
-    XPUSHs(sv_2mortal(CtoPerl("Unicode::GCString", gcstring_copy(spc))));
-    XPUSHs(sv_2mortal(CtoPerl("Unicode::GCString", gcstring_copy(str))));
-    PUTBACK;
-    count = call_sv(lbobj->sizing_data, G_SCALAR | G_EVAL);
+    index_header_t hdr;
+    fragments_t *frags = prep->frags;
+    SV *buf, *clusters;
+    size_t n = frags->nclusters, i;
+    char *p;
+    PerlIO *fp;
+
+    if ((U32)input->len != input->len)
+	croak("write_index: Text too long");
+
+    memset(&hdr, 0, sizeof(index_header_t));
+    memcpy(hdr.magic, INDEX_MAGIC, 8);
+    hdr.byteorder = PROFILE_BYTEORDER;
+    hdr.version = INDEX_VERSION;
+    hdr.hdrsize = sizeof(index_header_t);
+    strncpy(hdr.unicode_version, linebreak_unicode_version, 15);
+    hdr.config_hash = index_config_hash(prep->lbobj, "write_index");
+    hdr.text_hash = index_hash(INDEX_FNV_BASIS, input->str,
+			       sizeof(unichar_t) * input->len);
+    hdr.textlen = input->len;
+    hdr.nclusters = n;
+    hdr.nfrags = frags->len;
+
+    buf = sv_2mortal(newSVpvn((char *)&hdr, sizeof(index_header_t)));
+    clusters = sv_2mortal(newSVpvn("", 0));
+    for (i = 0; i < frags->len; i++) {
+	index_varint(buf, frags->spc[i] - frags->beg[i]);
+	index_varint(buf, ((size_t)(frags->beg[i + 1] - frags->spc[i]) << 1) |
+		     (frags->brk[i] == LAYOUT_BREAK_MANDATORY));
+    }
+    for (i = 0; i < n; i++)
+	index_varint(clusters, frags->idx[i + 1] - frags->idx[i]);
+    hdr.breaks_off = sizeof(index_header_t);
+    hdr.breaks_len = SvCUR(buf) - sizeof(index_header_t);
+    hdr.clusters_off = SvCUR(buf);
+    hdr.clusters_len = SvCUR(clusters);
+    sv_catsv(buf, clusters);
+    hdr.classes_off = SvCUR(buf);
+    sv_catpvn(buf, (char *)frags->lbc, n);
+    sv_catpvn(buf, (char *)frags->elbc, n);
+    sv_catpvn(buf, (char *)frags->flag, n);
+    hdr.widths_off = SvCUR(buf);
+    sv_catpvn(buf, (char *)frags->width, n);
+    if ((U32)SvCUR(buf) != SvCUR(buf))
+	croak("write_index: Text too long");
+    hdr.filelen = SvCUR(buf);
+    memcpy(SvPVX(buf), &hdr, sizeof(index_header_t));
+
+    p = SvPVX(buf);
+    if ((fp = PerlIO_open(filename, "wb")) == NULL)
+	croak("write_index: %s: %s", filename, strerror(errno));
+    if (PerlIO_write(fp, p, hdr.filelen) != (SSize_t)hdr.filelen) {
+	int err = errno;
+	PerlIO_close(fp);
+	croak("write_index: %s: %s", filename, strerror(err));
+    }
+    if (PerlIO_close(fp) != 0)
+	croak("write_index: %s: %s", filename, strerror(errno));
+}
 
-    SPAGAIN;
-    if (SvTRUE(ERRSV)) {
-	if (!lbobj->errnum)
-	    lbobj->errnum = LINEBREAK_EEXTN;
-	POPs;
-	return -1;
-    } else if (count != 1)
-	croak("sizing_func: internal error");
-    else
-	ret = POPn;
+/*
+ * Index file being read.  It is released by LEAVE unless it is taken by
+ * prepared text.
+ */
+typedef struct {
+    char *buf;
+    size_t len;
+    int mapped;
+    prepared_t *prep;
+} index_file_t;
 
-    PUTBACK;
-    FREETMPS;
-    LEAVE;
+static
+void index_file_free(pTHX_ void *data)
+{
+    index_file_t *file = (index_file_t *)data;
 
-    return ret;
+    prepared_destroy(file->prep);
+    if (file->buf != NULL) {
+#ifdef HAS_MMAP
+	if (file->mapped)
+	    munmap(file->buf, file->len);
+	else
+#endif /* HAS_MMAP */
+	    free(file->buf);
+    }
+    free(file);
 }
 
 /*
- * Call urgent breaking function
+ * Build fragments of prepared text from index.  If index is mapped,
+ * properties of clusters are laid out from the mapping, which is kept
+ * until prepared text is destroyed.  Returns false if index is broken.
  */
 static
-gcstring_t *urgent_func(linebreak_t *lbobj, gcstring_t *str)
+int index_fragments(prepared_t *prep, unistr_t *input, index_file_t *file,
+		    index_header_t *hdr)
 {
-    SV *sv;
-    int count;
-    size_t i;
-    gcstring_t *gcstr, *ret;
-
-    dSP;
-    ENTER;
-    SAVETMPS;
-    PUSHMARK(SP);
-    linebreak_incref(lbobj); /* mortal but should not be destroyed. */
-    XPUSHs(sv_2mortal(CtoPerl("Unicode::LineBreak", lbobj)));
-    XPUSHs(sv_2mortal(CtoPerl("Unicode::GCString", gcstring_copy(str))));
-    PUTBACK;
-    count = call_sv(lbobj->urgent_data, G_ARRAY | G_EVAL);
+    fragments_t *frags = prep->frags;
+    unsigned char *buf = (unsigned char *)file->buf;
+    const unsigned char *p, *end;
+    size_t n = hdr->nclusters, i, idx, len, spc, pos;
+
+    if (file->mapped) {
+	sharedbuf_map(buf + hdr->classes_off, file->buf, file->len);
+	file->buf = NULL;
+	free(frags->lbc);
+	free(frags->elbc);
+	free(frags->flag);
+	free(frags->width);
+	frags->lbc = buf + hdr->classes_off;
+	frags->elbc = buf + hdr->classes_off + n;
+	frags->flag = buf + hdr->classes_off + n * 2;
+	frags->width = buf + hdr->widths_off;
+	LAYOUT_GROW(frags->str, input->len + 1);
+	LAYOUT_GROW(frags->idx, n + 1);
+	frags->textsiz = input->len + 1;
+	frags->gcsiz = n + 1;
+    } else {
+	layout_grow_text(frags, input->len, n);
+	memcpy(frags->lbc, buf + hdr->classes_off, n);
+	memcpy(frags->elbc, buf + hdr->classes_off + n, n);
+	memcpy(frags->flag, buf + hdr->classes_off + n * 2, n);
+	memcpy(frags->width, buf + hdr->widths_off, n);
+    }
+    if (input->len)
+	memcpy(frags->str, input->str, sizeof(unichar_t) * input->len);
+    frags->textlen = input->len;
+    frags->nclusters = n;
+
+    p = buf + hdr->clusters_off;
+    end = p + hdr->clusters_len;
+    for (i = 0, idx = 0; i < n; i++) {
+	if (!index_unvarint(&p, end, &len) || len == 0 ||
+	    input->len - idx < len)
+	    return 0;
+	frags->idx[i] = idx;
+	idx += len;
+    }
+    frags->idx[n] = idx;
+    if (p != end || idx != input->len)
+	return 0;
 
-    SPAGAIN;
-    if (SvTRUE(ERRSV)) {
-	if (!lbobj->errnum)
-	    lbobj->errnum = LINEBREAK_EEXTN;
-	return NULL;
-    } if (count == 0)
-	return NULL;
+    p = buf + hdr->breaks_off;
+    end = p + hdr->breaks_len;
+    layout_grow(frags, hdr->nfrags);
+    for (i = 0, pos = 0; i < hdr->nfrags; i++) {
+	if (!index_unvarint(&p, end, &len) ||
+	    !index_unvarint(&p, end, &spc) ||
+	    n - pos < len || n - pos - len < (spc >> 1))
+	    return 0;
+	frags->beg[i] = pos;
+	frags->spc[i] = pos + len;
+	frags->beg[i + 1] = pos + len + (spc >> 1);
+	frags->brk[i] = (spc & 1) ? LAYOUT_BREAK_MANDATORY :
+	    LAYOUT_BREAK_ARBITRARY;
+	frags->len = i + 1;
+	layout_measure(prep->lbobj, frags, i);
+	pos = frags->beg[i + 1];
+    }
+    return p == end && pos == n;
+}
 
-    ret = gcstring_new(NULL, lbobj);
-    for (i = count; i; i--) {
-	sv = POPs;
-	if (SvOK(sv)) {
-	    gcstr = SVtogcstring(sv, lbobj);
-	    if (gcstr->gclen)
-		gcstr->gcstr[0].flag = LINEBREAK_FLAG_ALLOW_BEFORE;
-	    gcstring_replace(ret, 0, 0, gcstr);
-	    if (!sv_isobject(sv))
-		gcstring_destroy(gcstr);
+/*
+ * Create prepared text from INPUT and its index.  Index is mapped
+ * read-only, if possible.
+ */
+static
+prepared_t *index_read(linebreak_t *obj, unistr_t *input, char *filename)
+{
+    dTHX;
+    PerlIO *fp;
+    Stat_t st;
+    char *err = NULL;
+    index_file_t *file;
+    index_header_t *hdr;
+    prepared_t *ret = NULL;
+
+    if ((fp = PerlIO_open(filename, "rb")) == NULL)
+	croak("prepare: %s: %s", filename, strerror(errno));
+    if (PerlLIO_fstat(PerlIO_fileno(fp), &st) != 0) {
+	int e = errno;
+	PerlIO_close(fp);
+	croak("prepare: %s: %s", filename, strerror(e));
+    }
+    if ((size_t)st.st_size < sizeof(index_header_t)) {
+	PerlIO_close(fp);
+	croak("prepare: %s: Not a break index", filename);
+    }
+    if ((file = malloc(sizeof(index_file_t))) == NULL) {
+	PerlIO_close(fp);
+	croak("prepare: %s", strerror(errno));
+    }
+    memset(file, 0, sizeof(index_file_t));
+    file->len = st.st_size;
+    ENTER;
+    SAVEDESTRUCTOR_X(index_file_free, file);
+#ifdef HAS_MMAP
+    if ((file->buf = mmap(NULL, file->len, PROT_READ, MAP_SHARED,
+			  PerlIO_fileno(fp), 0)) == MAP_FAILED)
+	file->buf = NULL;
+    else
+	file->mapped = 1;
+#endif /* HAS_MMAP */
+    if (file->buf == NULL) {
+	if ((file->buf = malloc(file->len)) == NULL) {
+	    PerlIO_close(fp);
+	    croak("prepare: %s", strerror(errno));
+	}
+	if (PerlIO_read(fp, file->buf, file->len) != (SSize_t)file->len) {
+	    PerlIO_close(fp);
+	    croak("prepare: %s: Can't read", filename);
 	}
     }
-
-    PUTBACK;
-    FREETMPS;
+    PerlIO_close(fp);
+
+    hdr = (index_header_t *)(void *)file->buf;
+    if (memcmp(hdr->magic, INDEX_MAGIC, 8) != 0)
+	err = "Not a break index";
+    else if (hdr->byteorder != PROFILE_BYTEORDER ||
+	     hdr->version != INDEX_VERSION ||
+	     hdr->hdrsize != sizeof(index_header_t))
+	err = "Made on incompatible platform or by incompatible version";
+    else if (strncmp(hdr->unicode_version, linebreak_unicode_version, 16)
+	     != 0)
+	err = "Made by another version of Unicode";
+    else if (hdr->config_hash != index_config_hash(obj, "prepare"))
+	err = "Made with another configuration";
+    else if (hdr->textlen != input->len ||
+	     hdr->text_hash != index_hash(INDEX_FNV_BASIS, input->str,
+					  sizeof(unichar_t) * input->len))
+	err = "Made for another text";
+    else if (hdr->filelen != file->len || input->len < hdr->nclusters ||
+	     !INDEX_INRANGE(hdr->breaks_off, hdr->breaks_len, file->len) ||
+	     !INDEX_INRANGE(hdr->clusters_off, hdr->clusters_len,
+			    file->len) ||
+	     !INDEX_INRANGE(hdr->classes_off, (size_t)hdr->nclusters * 3,
+			    file->len) ||
+	     !INDEX_INRANGE(hdr->widths_off, hdr->nclusters, file->len) ||
+	     hdr->nclusters < hdr->nfrags)
+	err = "Broken index";
+    else {
+	file->prep = prepared_new(obj, NULL);
+	if (!index_fragments(file->prep, input, file, hdr))
+	    err = "Broken index";
+	else {
+	    ret = file->prep;
+	    file->prep = NULL;
+	}
+    }
+    if (err != NULL)
+	croak("prepare: %s: %s", filename, err);
     LEAVE;
-
     return ret;
 }
 
-
 MODULE = Unicode::LineBreak	PACKAGE = Unicode::LineBreak	
 
+BOOT:
+#ifdef USE_ITHREADS
+    if (!sharedbuf_mutex_initialized) {
+	MUTEX_INIT(&sharedbuf_mutex);
+	sharedbuf_mutex_initialized = 1;
+    }
+#endif /* USE_ITHREADS */
+    /* Constants of property values: EA_* and LB_*. */
+    {
+	HV *stash = gv_stashpv("Unicode::LineBreak", GV_ADD);
+	char **p, name[32];
+	IV i;
+
+	for (p = (char **)linebreak_propvals_EA, i = 0; *p != NULL; p++, i++) {
+	    snprintf(name, sizeof(name), "EA_%s", *p);
+	    newCONSTSUB(stash, name, newSViv(i));
+	}
+	for (p = (char **)linebreak_propvals_LB, i = 0; *p != NULL; p++, i++) {
+	    snprintf(name, sizeof(name), "LB_%s", *p);
+	    newCONSTSUB(stash, name, newSViv(i));
+	}
+    }
+
 void
 EAWidths()
     INIT:
@@ -584,7 +4431,109 @@ copy(self)
 	linebreak_t *self;
     PROTOTYPE: $
     CODE:
-	RETVAL = linebreak_copy(self);
+	if ((RETVAL = lbobj_share(self)) == NULL)
+	    croak("copy: %s", strerror(errno));
+    OUTPUT:
+	RETVAL
+
+linebreak_t *
+_clone(self)
+	linebreak_t *self;
+    PROTOTYPE: $
+    CODE:
+	if ((RETVAL = lbobj_share(self)) == NULL)
+	    croak("clone: %s", strerror(errno));
+	RETVAL->options &= ~LINEBREAK_OPTION_FROZEN;
+	/* Clone has its own stash. */
+	if (self->stash != NULL) {
+	    SV *stash = newRV_noinc((SV *)newHVhv((HV *)SvRV((SV *)self->stash)));
+	    linebreak_set_stash(RETVAL, stash);
+	    SvREFCNT_dec(stash); /* fixup */
+	}
+    OUTPUT:
+	RETVAL
+
+void
+_classify(self, str)
+	linebreak_t *self;
+	SV *str;
+    PROTOTYPE: $$
+    PREINIT:
+	SV *lbc, *eaw;
+	U8 *s, *end, *l, *e;
+	STRLEN len, clen;
+	unichar_t c;
+	propval_t p, q;
+    PPCODE:
+	if (SvOK(str))
+	    s = (U8 *)SvPV(str, len);
+	else {
+	    s = (U8 *)"";
+	    len = 0;
+	}
+	end = s + len;
+	/* Number of characters is not more than that of bytes. */
+	lbc = sv_2mortal(newSV(len + 1));
+	eaw = sv_2mortal(newSV(len + 1));
+	SvPOK_only(lbc);
+	SvPOK_only(eaw);
+	l = (U8 *)SvPVX(lbc);
+	e = (U8 *)SvPVX(eaw);
+	while (s < end) {
+	    if (*s < 0x80 || !SvUTF8(str))
+		c = (unichar_t)*s++;
+	    else {
+		c = utf8_decode_char(s, end, &clen);
+		if (clen == 0)
+		    croak("classify: Not well-formed UTF-8");
+		s += clen;
+	    }
+	    linebreak_charprop(self, c, &p, &q, NULL, NULL);
+	    *l++ = p;
+	    *e++ = q;
+	}
+	*l = *e = '\0';
+	SvCUR_set(lbc, l - (U8 *)SvPVX(lbc));
+	SvCUR_set(eaw, e - (U8 *)SvPVX(eaw));
+	XPUSHs(lbc);
+	if (GIMME_V == G_ARRAY) {
+	    XPUSHs(eaw);
+	    XSRETURN(2);
+	}
+	XSRETURN(1);
+
+void
+_freeze(self)
+	linebreak_t *self;
+    PROTOTYPE: $
+    CODE:
+	self->options |= LINEBREAK_OPTION_FROZEN;
+
+int
+frozen(self)
+	linebreak_t *self;
+    PROTOTYPE: $
+    CODE:
+	RETVAL = ((self->options & LINEBREAK_OPTION_FROZEN) != 0);
+    OUTPUT:
+	RETVAL
+
+void
+compile(self, filename)
+	linebreak_t *self;
+	char *filename;
+    PROTOTYPE: $$
+    CODE:
+	profile_compile(self, filename);
+
+linebreak_t *
+_load(klass, filename)
+	char *klass;
+	char *filename;
+    PROTOTYPE: $$
+    CODE:
+	PERL_UNUSED_VAR(klass);
+	RETVAL = profile_load(filename);
     OUTPUT:
 	RETVAL
 
@@ -593,7 +4542,7 @@ DESTROY(self)
 	linebreak_t *self;
     PROTOTYPE: $
     CODE:
-	linebreak_destroy(self);
+	lbobj_destroy(self);
 
 SV *
 _config(self, ...)
@@ -629,33 +4578,11 @@ _config(self, ...)
 		else
 		    RETVAL = newSVpvn("NONEASTASIAN", 12);
 	    } else if (strcasecmp(key, "EAWidth") == 0) {
-		AV *av, *codes = NULL, *ret = NULL;
-		propval_t p = PROP_UNKNOWN;
-		unichar_t c;
-		size_t i;
-
-		if (self->map == NULL || self->mapsiz == 0)
+		if ((RETVAL = maptoSV(self, 1, 0)) == NULL)
 		    XSRETURN_UNDEF;
-
-		for (i = 0; i < self->mapsiz; i++)
-		    if (self->map[i].eaw != PROP_UNKNOWN) {
-			if (p != self->map[i].eaw){
-			    p = self->map[i].eaw;
-			    codes = newAV();
-			    av = newAV();
-			    av_push(av, newRV_noinc((SV *)codes));
-			    av_push(av, newSViv((IV)p));
-			    if (ret == NULL)
-				ret = newAV();
-			    av_push(ret, newRV_noinc((SV *)av));
-			}
-			for (c = self->map[i].beg; c <= self->map[i].end; c++)
-			    av_push(codes, newSVuv(c));
-		    }
-
-		if (ret == NULL)
+	    } else if (strcasecmp(key, "EAWidthRanges") == 0) {
+		if ((RETVAL = maptoSV(self, 1, 1)) == NULL)
 		    XSRETURN_UNDEF;
-		RETVAL = newRV_noinc((SV *)ret);
 	    } else if (strcasecmp(key, "Format") == 0) {
 		func = self->format_func;
 		if (func == NULL)
@@ -676,34 +4603,17 @@ _config(self, ...)
 	    } else if (strcasecmp(key, "HangulAsAL") == 0)
 		RETVAL = newSVuv(self->options &
 				 LINEBREAK_OPTION_HANGUL_AS_AL);
-	    else if (strcasecmp(key, "LBClass") == 0) {
-		AV *av, *codes = NULL, *ret = NULL;
-		propval_t p = PROP_UNKNOWN;
-		unichar_t c;
-		size_t i;
-
-		if (self->map == NULL || self->mapsiz == 0)
+	    else if (strcasecmp(key, "Layout") == 0) {
+		if (self->options & LINEBREAK_OPTION_OPTIMAL_LAYOUT)
+		    RETVAL = newSVpvn("OPTIMAL", 7);
+		else
+		    RETVAL = newSVpvn("GREEDY", 6);
+	    } else if (strcasecmp(key, "LBClass") == 0) {
+		if ((RETVAL = maptoSV(self, 0, 0)) == NULL)
 		    XSRETURN_UNDEF;
-
-		for (i = 0; i < self->mapsiz; i++)
-		    if (self->map[i].lbc != PROP_UNKNOWN) {
-			if (p != self->map[i].lbc){
-			    p = self->map[i].lbc;
-			    codes = newAV();
-			    av = newAV();
-			    av_push(av, newRV_noinc((SV *)codes));
-			    av_push(av, newSViv((IV)p));
-			    if (ret == NULL)
-				ret = newAV();
-			    av_push(ret, newRV_noinc((SV *)av));
-			}
-			for (c = self->map[i].beg; c <= self->map[i].end; c++)
-			    av_push(codes, newSVuv(c));
-		    }
-
-		if (ret == NULL)
+	    } else if (strcasecmp(key, "LBClassRanges") == 0) {
+		if ((RETVAL = maptoSV(self, 0, 1)) == NULL)
 		    XSRETURN_UNDEF;
-		RETVAL = newRV_noinc((SV *)ret);
 	    } else if (strcasecmp(key, "LegacyCM") == 0)
 		RETVAL = newSVuv(self->options & LINEBREAK_OPTION_LEGACY_CM);
 	    else if (strcasecmp(key, "Newline") == 0) {
@@ -769,6 +4679,8 @@ _config(self, ...)
 	    }
 	} else if (!(items % 2))
 	    croak("_config: Argument size mismatch");
+	else if (self->options & LINEBREAK_OPTION_FROZEN)
+	    croak("_config: Can't modify frozen object");
 	else for (RETVAL = NULL, i = 1; i < items; i += 2) {
 	    if (!SvPOK(ST(i)))
 		croak("_config: Illegal argument");
@@ -944,82 +4856,33 @@ _config(self, ...)
 		else
 		    self->options &= ~LINEBREAK_OPTION_EASTASIAN_CONTEXT;
 	    } else if (strcasecmp(key, "EAWidth") == 0) {
-		AV *av, *codes;
-		SV *sv;
-		propval_t p;
-		size_t i;
-
+		lbobj_unshare(self);
 		if (! SvOK(val))
 		    linebreak_clear_eawidth(self);
-		else if (SvROK(val) &&
-		    SvTYPE(av = (AV *)SvRV(val)) == SVt_PVAV &&
-		    av_len(av) + 1 == 2 &&
-		    av_fetch(av, 0, 0) != NULL && av_fetch(av, 1, 0) != NULL) {
-		    sv = *av_fetch(av, 1, 0);
-		    if (SvIOK(sv))
-			p = (propval_t) SvIV(sv);
-		    else
-			croak("_config: Invalid argument");
-
-		    sv = *av_fetch(av, 0, 0);
-		    if (SvROK(sv) &&
-			SvTYPE(codes = (AV *)SvRV(sv)) == SVt_PVAV) {
-			for (i = 0; i < av_len(codes) + 1; i++) {
-			    if (av_fetch(codes, i, 0) == NULL)
-				continue;
-			    if (! SvIOK(sv = *av_fetch(codes, i, 0)))
-				croak("_config: Invalid argument");
-			    linebreak_update_eawidth(self,
-						     (unichar_t) SvUV(sv), p);
-			}
-		    } else if (SvIOK(sv)) {
-			linebreak_update_eawidth(self, (unichar_t) SvUV(sv),
-						 p);
-		    } else
-			croak("_config: Invalid argument");
-		} else
-		    croak("_config: Invalid argument");
+		else
+		    SVtomap(self, val, 1);
 	    } else if (strcasecmp(key, "HangulAsAL") == 0) {
 		if (SVtoboolean(val))
 		    self->options |= LINEBREAK_OPTION_HANGUL_AS_AL;
 		else
 		    self->options &= ~LINEBREAK_OPTION_HANGUL_AS_AL;
+	    } else if (strcasecmp(key, "Layout") == 0) {
+		if (SvOK(val))
+		    opt = (char *)SvPV_nolen(val);
+		else
+		    opt = "GREEDY";
+		if (strcasecmp(opt, "OPTIMAL") == 0)
+		    self->options |= LINEBREAK_OPTION_OPTIMAL_LAYOUT;
+		else if (strcasecmp(opt, "GREEDY") == 0)
+		    self->options &= ~LINEBREAK_OPTION_OPTIMAL_LAYOUT;
+		else
+		    croak("_config: Unknown Layout option: %s", opt);
 	    } else if (strcasecmp(key, "LBClass") == 0) {
-		AV *av, *codes;
-		SV *sv;
-		propval_t p;
-		size_t i;
-
+		lbobj_unshare(self);
 		if (! SvOK(val))
 		    linebreak_clear_lbclass(self);
-		else if (SvROK(val) &&
-		    SvTYPE(av = (AV *)SvRV(val)) == SVt_PVAV &&
-		    av_len(av) + 1 == 2 &&
-		    av_fetch(av, 0, 0) != NULL && av_fetch(av, 1, 0) != NULL) {
-		    sv = *av_fetch(av, 1, 0);
-		    if (SvIOK(sv))
-			p = (propval_t) SvIV(sv);
-		    else
-			croak("_config: Invalid argument");
-
-		    sv = *av_fetch(av, 0, 0);
-		    if (SvROK(sv) &&
-			SvTYPE(codes = (AV *)SvRV(sv)) == SVt_PVAV) {
-			for (i = 0; i < av_len(codes) + 1; i++) {
-			    if (av_fetch(codes, i, 0) == NULL)
-				continue;
-			    if (! SvIOK(sv = *av_fetch(codes, i, 0)))
-				croak("_config: Invalid argument");
-			    linebreak_update_lbclass(self,
-						     (unichar_t) SvUV(sv), p);
-			}
-		    } else if (SvIOK(sv)) {
-			linebreak_update_lbclass(self, (unichar_t) SvUV(sv),
-						 p);
-		    } else
-			croak("_config: Invalid argument");
-		} else
-		    croak("_config: Invalid argument");
+		else
+		    SVtomap(self, val, 0);
 	    } else if (strcasecmp(key, "LegacyCM") == 0) {
 		if (SVtoboolean(val))
 		    self->options |= LINEBREAK_OPTION_LEGACY_CM;
@@ -1130,6 +4993,8 @@ reset(self)
 	linebreak_t *self;
     PROTOTYPE: $
     CODE:
+	if (self->options & LINEBREAK_OPTION_FROZEN)
+	    croak("reset: Can't modify frozen object");
 	linebreak_reset(self);
 
 double
@@ -1162,7 +5027,85 @@ break(self, input)
     PPCODE:
 	if (input == NULL)
 	    XSRETURN_UNDEF;
-	ret = linebreak_break(self, input);
+	if (self->options & LINEBREAK_OPTION_OPTIMAL_LAYOUT)
+	    ret = optimal_break(self, input);
+	else
+	    ret = linebreak_break(self, input);
+
+	if (ret == NULL) {
+	    if (self->errnum == LINEBREAK_EEXTN)
+		croak("%s", SvPV_nolen(ERRSV));
+	    else if (self->errnum == LINEBREAK_ELONG)
+		croak("%s", "Excessive line was found");
+	    else if (self->errnum)
+		croak("%s", strerror(self->errnum));
+	    else
+		croak("%s", "Unknown error");
+	}
+
+	switch (GIMME_V) {
+	case G_SCALAR:
+	    r = gcstring_new(NULL, self);
+	    for (i = 0; ret[i] != NULL; i++)
+		gcstring_append(r, ret[i]);
+	    linebreak_free_result(ret, 1);
+	    XPUSHs(sv_2mortal(unistrtoSV((unistr_t *)r, 0, r->len)));
+	    gcstring_destroy(r);
+	    XSRETURN(1);
+
+	case G_ARRAY:
+	    for (i = 0; ret[i] != NULL; i++)
+		XPUSHs(sv_2mortal(CtoPerl("Unicode::GCString", ret[i])));
+	    linebreak_free_result(ret, 0);
+	    XSRETURN(i);
+
+	default:
+	    linebreak_free_result(ret, 1);
+	    XSRETURN_EMPTY;
+	}
+
+void
+break_bitmap(self, input)
+	linebreak_t *self;
+	unistr_t *input;
+    PROTOTYPE: $$
+    PREINIT:
+	SV *allowed, *mandatory;
+    PPCODE:
+	if (input == NULL)
+	    XSRETURN_UNDEF;
+	allowed = bitmap_new(aTHX_ input->len);
+	mandatory = bitmap_new(aTHX_ input->len);
+	if (!break_bitmap(aTHX_ self, input, (U8 *)SvPVX(allowed),
+			  (U8 *)SvPVX(mandatory))) {
+	    if (self->errnum == LINEBREAK_EEXTN)
+		croak("%s", SvPV_nolen(ERRSV));
+	    else if (self->errnum)
+		croak("%s", strerror(self->errnum));
+	    else
+		croak("%s", "Unknown error");
+	}
+	XPUSHs(allowed);
+	if (GIMME_V == G_ARRAY) {
+	    XPUSHs(mandatory);
+	    XSRETURN(2);
+	}
+	XSRETURN(1);
+
+void
+break_partial(self, input)
+	linebreak_t *self;
+	unistr_t *input;
+    PROTOTYPE: $$
+    PREINIT:
+	gcstring_t **ret, *r;
+	size_t i;
+    PPCODE:
+	if (self->options & LINEBREAK_OPTION_FROZEN)
+	    croak("break_partial: Can't modify frozen object");
+	if (self->options & LINEBREAK_OPTION_OPTIMAL_LAYOUT)
+	    croak("break_partial: Not supported by OPTIMAL layout");
+	ret = linebreak_break_partial(self, input);
 
 	if (ret == NULL) {
 	    if (self->errnum == LINEBREAK_EEXTN)
@@ -1197,17 +5140,25 @@ break(self, input)
 	}
 
 void
-break_partial(self, input)
+measure(self, input)
 	linebreak_t *self;
 	unistr_t *input;
     PROTOTYPE: $$
     PREINIT:
-	gcstring_t **ret, *r;
+	fragments_t *frags;
 	size_t i;
+	SSize_t nlines = -1;
+	double *cols, maxcols;
     PPCODE:
-	ret = linebreak_break_partial(self, input);
-
-	if (ret == NULL) {
+	if (input == NULL)
+	    XSRETURN_UNDEF;
+	if ((frags = layout_fragments(self, input)) != NULL) {
+	    ENTER;
+	    SAVEDESTRUCTOR_X(layout_unwind_fragments, frags);
+	    nlines = layout_measure_lines(self, frags, &cols);
+	    LEAVE;
+	}
+	if (nlines < 0) {
 	    if (self->errnum == LINEBREAK_EEXTN)
 		croak("%s", SvPV_nolen(ERRSV));
 	    else if (self->errnum == LINEBREAK_ELONG)
@@ -1220,25 +5171,74 @@ break_partial(self, input)
 
 	switch (GIMME_V) {
 	case G_SCALAR:
-	    r = gcstring_new(NULL, self);
-	    for (i = 0; ret[i] != NULL; i++)
-		gcstring_append(r, ret[i]);
-	    linebreak_free_result(ret, 1);
-	    XPUSHs(sv_2mortal(unistrtoSV((unistr_t *)r, 0, r->len)));
-	    gcstring_destroy(r);
+	    free(cols);
+	    XPUSHs(sv_2mortal(newSViv(nlines)));
 	    XSRETURN(1);
 
 	case G_ARRAY:
-	    for (i = 0; ret[i] != NULL; i++)
-		XPUSHs(sv_2mortal(CtoPerl("Unicode::GCString", ret[i])));
-	    linebreak_free_result(ret, 0);
-	    XSRETURN(i);
+	    for (i = 0, maxcols = 0.0; i < (size_t)nlines; i++)
+		if (maxcols < cols[i])
+		    maxcols = cols[i];
+	    XPUSHs(sv_2mortal(newSViv(nlines)));
+	    XPUSHs(sv_2mortal(newSVnv(maxcols)));
+	    XPUSHs(sv_2mortal(newSVpvn((char *)(void *)cols,
+				       sizeof(double) * nlines)));
+	    free(cols);
+	    XSRETURN(3);
 
 	default:
-	    linebreak_free_result(ret, 1);
+	    free(cols);
 	    XSRETURN_EMPTY;
 	}
 
+prepared_t *
+prepare(self, input, filename=NULL)
+	linebreak_t *self;
+	unistr_t *input;
+	char *filename;
+    PROTOTYPE: $$;$
+    CODE:
+	if (input == NULL)
+	    XSRETURN_UNDEF;
+	if (filename != NULL)
+	    RETVAL = index_read(self, input, filename);
+	else
+	    RETVAL = prepared_new(self, input);
+	if (RETVAL == NULL) {
+	    if (self->errnum == LINEBREAK_EEXTN)
+		croak("%s", SvPV_nolen(ERRSV));
+	    else if (self->errnum == LINEBREAK_ELONG)
+		croak("%s", "Excessive line was found");
+	    else if (self->errnum)
+		croak("%s", strerror(self->errnum));
+	    else
+		croak("%s", "Unknown error");
+	}
+    OUTPUT:
+	RETVAL
+
+void
+write_index(self, input, filename)
+	linebreak_t *self;
+	unistr_t *input;
+	char *filename;
+    PROTOTYPE: $$$
+    INIT:
+	prepared_t *prep;
+    CODE:
+	if (input == NULL)
+	    croak("write_index: Undefined string");
+	if ((prep = prepared_new(self, input)) == NULL) {
+	    if (self->errnum == LINEBREAK_EEXTN)
+		croak("%s", SvPV_nolen(ERRSV));
+	    else if (self->errnum)
+		croak("%s", strerror(self->errnum));
+	    else
+		croak("%s", "Unknown error");
+	}
+	sv_2mortal(CtoPerl("Unicode::LineBreak::Prepared", prep));
+	index_write(prep, input, filename);
+
 const char *
 UNICODE_VERSION()
     CODE:
@@ -1266,6 +5266,101 @@ supported()
     OUTPUT:
 	RETVAL
 
+MODULE = Unicode::LineBreak	PACKAGE = Unicode::LineBreak::Prepared
+
+void
+DESTROY(self)
+	prepared_t *self;
+    PROTOTYPE: $
+    CODE:
+	prepared_destroy(self);
+
+void
+measure(self, ...)
+	prepared_t *self;
+    PREINIT:
+	linebreak_t *obj;
+	size_t i;
+	SSize_t nlines;
+	double *cols, maxcols;
+    PPCODE:
+	obj = prepared_config(self, &ST(1), items - 1, "measure");
+	if ((nlines = layout_measure_lines(obj, self->frags, &cols)) < 0) {
+	    if (obj->errnum == LINEBREAK_EEXTN)
+		croak("%s", SvPV_nolen(ERRSV));
+	    else if (obj->errnum == LINEBREAK_ELONG)
+		croak("%s", "Excessive line was found");
+	    else if (obj->errnum)
+		croak("%s", strerror(obj->errnum));
+	    else
+		croak("%s", "Unknown error");
+	}
+
+	switch (GIMME_V) {
+	case G_SCALAR:
+	    free(cols);
+	    XPUSHs(sv_2mortal(newSViv(nlines)));
+	    XSRETURN(1);
+
+	case G_ARRAY:
+	    for (i = 0, maxcols = 0.0; i < (size_t)nlines; i++)
+		if (maxcols < cols[i])
+		    maxcols = cols[i];
+	    XPUSHs(sv_2mortal(newSViv(nlines)));
+	    XPUSHs(sv_2mortal(newSVnv(maxcols)));
+	    XPUSHs(sv_2mortal(newSVpvn((char *)(void *)cols,
+				       sizeof(double) * nlines)));
+	    free(cols);
+	    XSRETURN(3);
+
+	default:
+	    free(cols);
+	    XSRETURN_EMPTY;
+	}
+
+void
+layout(self, ...)
+	prepared_t *self;
+    PREINIT:
+	linebreak_t *obj;
+	gcstring_t **ret, *r;
+	size_t i;
+    PPCODE:
+	obj = prepared_config(self, &ST(1), items - 1, "layout");
+	ret = layout_break(obj, self->frags);
+
+	if (ret == NULL) {
+	    if (obj->errnum == LINEBREAK_EEXTN)
+		croak("%s", SvPV_nolen(ERRSV));
+	    else if (obj->errnum == LINEBREAK_ELONG)
+		croak("%s", "Excessive line was found");
+	    else if (obj->errnum)
+		croak("%s", strerror(obj->errnum));
+	    else
+		croak("%s", "Unknown error");
+	}
+
+	switch (GIMME_V) {
+	case G_SCALAR:
+	    r = gcstring_new(NULL, obj);
+	    for (i = 0; ret[i] != NULL; i++)
+		gcstring_append(r, ret[i]);
+	    linebreak_free_result(ret, 1);
+	    XPUSHs(sv_2mortal(unistrtoSV((unistr_t *)r, 0, r->len)));
+	    gcstring_destroy(r);
+	    XSRETURN(1);
+
+	case G_ARRAY:
+	    for (i = 0; ret[i] != NULL; i++)
+		XPUSHs(sv_2mortal(CtoPerl("Unicode::GCString", ret[i])));
+	    linebreak_free_result(ret, 0);
+	    XSRETURN(i);
+
+	default:
+	    linebreak_free_result(ret, 1);
+	    XSRETURN_EMPTY;
+	}
+
 MODULE = Unicode::LineBreak	PACKAGE = Unicode::GCString	
 
 gcstring_t *
@@ -1278,7 +5373,11 @@ _new(klass, str, lbobj=NULL)
 	if (str == NULL)
 	    XSRETURN_UNDEF;
 	/* FIXME:buffer is copied twice. */
-	if ((RETVAL = gcstring_newcopy(str, lbobj)) == NULL)
+	if (sv_isobject(ST(1)))
+	    RETVAL = gcstring_newcopy(str, lbobj);
+	else
+	    RETVAL = ascii_gcstring_newcopy(str, lbobj);
+	if (RETVAL == NULL)
 	    croak("%s->_new: %s", klass, strerror(errno));
     OUTPUT:
 	RETVAL
@@ -1288,6 +5387,11 @@ DESTROY(self)
 	gcstring_t *self;
     PROTOTYPE: $
     CODE:
+	if (self != NULL) {
+	    lbobj_destroy(self->lbobj);
+	    self->lbobj = NULL;
+	    gcstring_detach(aTHX_ SvRV(ST(0)), self);
+	}
 	gcstring_destroy(self);
 
 void
@@ -1295,13 +5399,13 @@ as_array(self)
 	gcstring_t *self;
     PROTOTYPE: $
     PREINIT:
+	SV *sv = ST(0);
 	size_t i;
     PPCODE:
 	if (self != NULL)
 	    for (i = 0; i < self->gclen; i++)
-		XPUSHs(sv_2mortal(
-			   CtoPerl("Unicode::GCString", 
-				   gcstring_substr(self, i, 1))));
+		XPUSHs(sv_2mortal(gcstring_slice(aTHX_ sv, i, 1,
+						 "as_array")));
 
 SV*
 as_scalarref(self, ...)
@@ -1321,7 +5425,7 @@ as_string(self, ...)
 	gcstring_t *self;
     PROTOTYPE: $;$;$
     CODE:
-	RETVAL = unistrtoSV((unistr_t *)self, 0, self->len);
+	RETVAL = gcstring_utf8(aTHX_ SvRV(ST(0)), self);
     OUTPUT:
 	RETVAL
 
@@ -1334,26 +5438,72 @@ chars(self)
     OUTPUT:
 	RETVAL
 
-#define lbobj self->lbobj
+SV *
+cluster_records(self)
+	gcstring_t *self;
+    PROTOTYPE: $
+    PREINIT:
+	gcchar_t *gc;
+	U8 *rec;
+	U32 u;
+	size_t i;
+    CODE:
+	RETVAL = newSV(GCSTRING_RECORD_SIZE * self->gclen + 1);
+	SvPOK_only(RETVAL);
+	rec = (U8 *)SvPVX(RETVAL);
+	for (i = 0; i < self->gclen; i++, rec += GCSTRING_RECORD_SIZE) {
+	    gc = self->gcstr + i;
+	    u = (U32)gc->idx;
+	    memcpy(rec, &u, 4);
+	    u = (U32)gc->len;
+	    memcpy(rec + 4, &u, 4);
+	    rec[8] = (U8)gc->col;
+	    rec[9] = gc->lbc;
+	    rec[10] = (gc->elbc == PROP_UNKNOWN) ? gc->lbc : gc->elbc;
+	    rec[11] = gc->flag;
+	}
+	*rec = '\0';
+	SvCUR_set(RETVAL, GCSTRING_RECORD_SIZE * self->gclen);
+    OUTPUT:
+	RETVAL
+
 int
 cmp(self, str, swap=FALSE)
 	gcstring_t *self;
-	generic_string str;
+	SV *str;
 	swapspec_t swap;
     PROTOTYPE: $$;$
     CODE:
-	if (swap == TRUE)
-	    RETVAL = gcstring_cmp(str, self);
+	if (!sv_isobject(str))
+	    RETVAL = gcstring_cmp_sv(aTHX_ SvRV(ST(0)), self, str);
+	else if (sv_derived_from(str, "Unicode::GCString"))
+	    RETVAL = unistr_cmp((unistr_t *)self,
+				(unistr_t *)PerltoC(gcstring_t *, str));
 	else
-	    RETVAL = gcstring_cmp(self, str);
+	    croak("cmp: Unknown object %s", HvNAME(SvSTASH(SvRV(str))));
+	if (swap == TRUE)
+	    RETVAL = -RETVAL;
     OUTPUT:
 	RETVAL
 
 size_t
-columns(self)
+columns(self, offset=0, length=self->gclen)
+	gcstring_t *self;
+	int offset;
+	int length;
+    PROTOTYPE: $;$;$
+    CODE:
+	gcstring_range(self->gclen, &offset, &length);
+	RETVAL = gcstring_colsum(aTHX_ SvRV(ST(0)), self, offset, length);
+    OUTPUT:
+	RETVAL
+
+SV *
+columns_array(self)
 	gcstring_t *self;
+    PROTOTYPE: $
     CODE:
-	RETVAL = gcstring_columns(self);
+	RETVAL = gcstring_props(self, GCSTRING_PROP_COLUMNS);
     OUTPUT:
 	RETVAL
 
@@ -1368,7 +5518,7 @@ concat(self, str, swap=FALSE)
 	if (swap == TRUE)
 	    RETVAL = gcstring_concat(str, self);
 	else if (swap == -1) {
-	    gcstring_append(self, str);
+	    gcstring_append_inplace(aTHX_ SvRV(ST(0)), self, str);
 	    XSRETURN(1);
 	} else
 	    RETVAL = gcstring_concat(self, str);
@@ -1384,6 +5534,47 @@ copy(self)
     OUTPUT:
 	RETVAL
 
+void
+each_cluster(self, func)
+	gcstring_t *self;
+	SV *func;
+    PROTOTYPE: $$
+    PREINIT:
+	size_t i;
+    CODE:
+	/* Callback may release the string: Keep it till we return. */
+	sv_2mortal(SvREFCNT_inc(SvRV(ST(0))));
+	/* Callback may modify the string: See its length each time. */
+	for (i = 0; i < self->gclen; i++) {
+	    ENTER;
+	    SAVETMPS;
+	    PUSHMARK(SP);
+	    SP = gcstring_push_cluster(aTHX_ SP, self, i);
+	    PUTBACK;
+	    call_sv(func, G_VOID | G_DISCARD);
+	    SPAGAIN;
+	    FREETMPS;
+	    LEAVE;
+	}
+
+gceditor_t *
+editor(self)
+	gcstring_t *self;
+    PROTOTYPE: $
+    CODE:
+	RETVAL = editor_new(self);
+    OUTPUT:
+	RETVAL
+
+SV *
+eaw_array(self)
+	gcstring_t *self;
+    PROTOTYPE: $
+    CODE:
+	RETVAL = gcstring_props(self, GCSTRING_PROP_EAW);
+    OUTPUT:
+	RETVAL
+
 int
 eos(self)
 	gcstring_t *self;
@@ -1418,7 +5609,16 @@ flag(self, ...)
     OUTPUT:
 	RETVAL
 
-gcstring_t *
+SV *
+flag_array(self)
+	gcstring_t *self;
+    PROTOTYPE: $
+    CODE:
+	RETVAL = gcstring_props(self, GCSTRING_PROP_FLAG);
+    OUTPUT:
+	RETVAL
+
+SV *
 item(self, ...)
 	gcstring_t *self;
     PROTOTYPE: $;$
@@ -1432,7 +5632,7 @@ item(self, ...)
 	if (i < 0 || self == NULL || self->gclen <= i)
 	    XSRETURN_UNDEF;
 
-	RETVAL = gcstring_substr(self, i, 1);
+	RETVAL = gcstring_slice(aTHX_ ST(0), i, 1, "item");
     OUTPUT:
 	RETVAL
 
@@ -1480,6 +5680,15 @@ lbc(self)
     OUTPUT:
 	RETVAL
 
+SV *
+lbc_array(self)
+	gcstring_t *self;
+    PROTOTYPE: $
+    CODE:
+	RETVAL = gcstring_props(self, GCSTRING_PROP_LBC);
+    OUTPUT:
+	RETVAL
+
 propval_t
 lbcext(self)
 	gcstring_t *self;
@@ -1490,6 +5699,15 @@ lbcext(self)
     OUTPUT:
 	RETVAL
 
+SV *
+lbcext_array(self)
+	gcstring_t *self;
+    PROTOTYPE: $
+    CODE:
+	RETVAL = gcstring_props(self, GCSTRING_PROP_LBCEXT);
+    OUTPUT:
+	RETVAL
+
 propval_t
 lbclass(self, ...)
 	gcstring_t *self;
@@ -1535,7 +5753,7 @@ length(self)
     OUTPUT:
 	RETVAL
 
-gcstring_t *
+SV *
 next(self, ...)
 	gcstring_t *self;
     PROTOTYPE: $;$;$
@@ -1545,10 +5763,22 @@ next(self, ...)
 	if (gcstring_eos(self))
 	    XSRETURN_UNDEF;
 	gc = gcstring_next(self);
-	RETVAL = gcstring_substr(self, gc - self->gcstr, 1);
+	RETVAL = gcstring_slice(aTHX_ ST(0), gc - self->gcstr, 1, "next");
     OUTPUT:
 	RETVAL
 
+void
+next_cluster(self)
+	gcstring_t *self;
+    PROTOTYPE: $
+    PREINIT:
+	gcchar_t *gc;
+    PPCODE:
+	if (gcstring_eos(self))
+	    XSRETURN_EMPTY;
+	gc = gcstring_next(self);
+	SP = gcstring_push_cluster(aTHX_ SP, self, gc - self->gcstr);
+
 size_t
 pos(self, ...)
 	gcstring_t *self;
@@ -1560,21 +5790,107 @@ pos(self, ...)
     OUTPUT:
 	RETVAL
 
+void
+sort(list)
+	SV *list;
+    PROTOTYPE: $
+    CODE:
+	if (!SvROK(list) || SvTYPE(SvRV(list)) != SVt_PVAV)
+	    croak("sort: Not array reference");
+	gcstring_sort(aTHX_ (AV *)SvRV(list));
+
 #define lbobj self->lbobj
-gcstring_t *
+SV *
 substr(self, offset, length=self->gclen, replacement=NULL)
 	gcstring_t *self;
 	int offset;
 	int length;
 	generic_string replacement;
     PROTOTYPE: $$;$;$
+    PREINIT:
+	gcstring_t *ret;
     CODE:
-	RETVAL = gcstring_substr(self, offset, length);
-	if (replacement != NULL)
+	if (replacement == NULL)
+	    RETVAL = gcstring_slice(aTHX_ ST(0), offset, length, "substr");
+	else {
+	    if ((ret = gcstring_substr(self, offset, length)) == NULL)
+		croak("substr: %s", strerror(errno));
+	    RETVAL = CtoPerl("Unicode::GCString", ret);
+	    gcstring_unshare(aTHX_ SvRV(ST(0)), self);
+	    gcstring_capa_reset(aTHX_ SvRV(ST(0)));
+	    gcstring_utf8_reset(aTHX_ SvRV(ST(0)));
+	    gcstring_cols_truncate(aTHX_ SvRV(ST(0)), 0);
 	    if (gcstring_replace(self, offset, length, replacement) == NULL)
 		croak("substr: %s", strerror(errno));
-	if (RETVAL == NULL)
-	    croak("substr: %s", strerror(errno));
+	}
+    OUTPUT:
+	RETVAL
+
+MODULE = Unicode::LineBreak	PACKAGE = Unicode::GCString::Editor
+
+void
+DESTROY(self)
+	gceditor_t *self;
+    PROTOTYPE: $
+    CODE:
+	editor_destroy(self);
+
+gcstring_t *
+as_gcstring(self)
+	gceditor_t *self;
+    PROTOTYPE: $
+    CODE:
+	RETVAL = editor_substr(self, 0, self->gclen);
+    OUTPUT:
+	RETVAL
+
+SV *
+as_string(self, ...)
+	gceditor_t *self;
+    PROTOTYPE: $;$;$
+    PREINIT:
+	unistr_t unistr;
+    CODE:
+	unistr.str = self->str;
+	unistr.len = self->gap;
+	RETVAL = unistrtoSV(&unistr, 0, unistr.len);
+	unistr.str = self->str + self->siz - self->len + self->gap;
+	unistr.len = self->len - self->gap;
+	if (unistr.len)
+	    sv_catsv(RETVAL, sv_2mortal(unistrtoSV(&unistr, 0, unistr.len)));
+    OUTPUT:
+	RETVAL
+
+size_t
+chars(self)
+	gceditor_t *self;
+    PROTOTYPE: $
+    CODE:
+	RETVAL = self->len;
+    OUTPUT:
+	RETVAL
+
+size_t
+length(self)
+	gceditor_t *self;
+    PROTOTYPE: $
+    CODE:
+	RETVAL = self->gclen;
     OUTPUT:
 	RETVAL
 
+#define lbobj self->lbobj
+gcstring_t *
+substr(self, offset, length=self->gclen, replacement=NULL)
+	gceditor_t *self;
+	int offset;
+	int length;
+	generic_string replacement;
+    PROTOTYPE: $$;$;$
+    CODE:
+	gcstring_range(self->gclen, &offset, &length);
+	RETVAL = editor_substr(self, offset, length);
+	if (replacement != NULL)
+	    editor_replace(self, offset, length, replacement);
+    OUTPUT:
+	RETVAL
@@ -0,0 +1,32 @@
+#! perl
+#
+# Measures time of localized replacements on a long grapheme cluster string
+# by substr() of Unicode::GCString and by its editor.
+#
+# Usage: perl -Mblib bench/edit.pl [CLUSTERS [EDITS]]
+#
+
+use strict;
+use warnings;
+use Time::HiRes qw(time);
+use Unicode::GCString;
+
+my $clusters = shift || 100_000;
+my $edits = shift || 10_000;
+my $unit = "The quick brown fox \x{3042}\x{3044} jumps. ";
+my $text = $unit x int($clusters / length($unit) + 1);
+
+foreach my $mode (qw(substr editor)) {
+    my $gcs = Unicode::GCString->new($text);
+    my $obj = ($mode eq 'editor') ? $gcs->editor : $gcs;
+    my $pos = int($gcs->length / 2);
+    srand 1;
+    my $start = time;
+    foreach (1..$edits) {
+        $pos += int(rand 41) - 20;
+        $pos = 0 if $pos < 0;
+        $obj->substr($pos, 2, 'ab');
+    }
+    my $elapsed = time - $start;
+    printf "%-24s %10.2f kedits/s\n", $mode, $edits / $elapsed / 1e3;
+}
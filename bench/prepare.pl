@@ -0,0 +1,65 @@
+#! perl
+#
+# Measures memory and time to prepare texts and lay them out.
+#
+# Usage: perl -Mblib bench/prepare.pl [FILE ...]
+#
+# Files are UTF-8 texts; test-data/*.in by default.  Memory is measured on
+# platforms having /proc/self/statm.  It is the memory of prepared texts
+# alone; grapheme cluster strings (Unicode::GCString) are kept by the
+# sombok library and are not measured.  Results depend on the library
+# linked, so compare figures only among builds with the same library.
+#
+
+use strict;
+use warnings;
+use Time::HiRes qw(time);
+use Unicode::LineBreak;
+
+my @files = scalar @ARGV ? @ARGV : glob 'test-data/*.in';
+die "No input files\n" unless scalar @files;
+my @texts = map {
+    open my $fh, '<:encoding(UTF-8)', $_ or die "$_: $!\n";
+    local $/;
+    scalar <$fh>;
+} @files;
+my $chars = 0;
+$chars += length $_ foreach @texts;
+
+sub rss {
+    open my $fh, '<', '/proc/self/statm' or return undef;
+    my (undef, $pages) = split ' ', scalar <$fh>;
+    return $pages * 4096;
+}
+
+my $lb = Unicode::LineBreak->new;
+my $copies = 1;
+$copies++ while $chars * $copies < 1_000_000;
+
+my $rss = rss();
+my $start = time;
+my @prepared = map { my $t = $_; map { $lb->prepare($t) } 1..$copies } @texts;
+my $elapsed = time - $start;
+my $after = rss();
+printf "%-24s %10d chars\n", 'text', $chars * $copies;
+printf "%-24s %10.1f bytes/char\n", 'memory of prepared',
+    ($after - $rss) / ($chars * $copies) if defined $rss;
+printf "%-24s %10.2f Mchars/s\n", 'prepare', $chars * $copies / $elapsed / 1e6;
+
+foreach my $layout (qw(GREEDY OPTIMAL)) {
+    $start = time;
+    foreach my $prep (@prepared) {
+        $prep->layout(ColMax => $_, Layout => $layout) foreach (20, 40, 60, 80);
+    }
+    $elapsed = time - $start;
+    printf "%-24s %10.2f Mchars/s\n", "layout ($layout)",
+        4 * $chars * $copies / $elapsed / 1e6;
+    $start = time;
+    foreach my $prep (@prepared) {
+        scalar $prep->measure(ColMax => $_, Layout => $layout)
+            foreach (20, 40, 60, 80);
+    }
+    $elapsed = time - $start;
+    printf "%-24s %10.2f Mchars/s\n", "measure ($layout)",
+        4 * $chars * $copies / $elapsed / 1e6;
+}
@@ -0,0 +1,36 @@
+#! perl
+#
+# Measures time to load modules.
+#
+# Usage: perl -Mblib bench/startup.pl [COUNT]
+#
+
+use strict;
+use warnings;
+use Config;
+use Time::HiRes qw(time);
+
+my $count = shift || 20;
+my @cases = (
+    ['perl' => '-e1'],
+    ['Unicode::GCString' => '-MUnicode::GCString', '-e1'],
+    ['Unicode::LineBreak' => '-MUnicode::LineBreak', '-e1'],
+    ['Unicode::LineBreak (:all)' => '-MUnicode::LineBreak=:all', '-e1'],
+    ['Text::LineFold' => '-MText::LineFold', '-e1'],
+    ['Text::LineFold->new' => '-MText::LineFold',
+     '-eText::LineFold->new->fold("", "", "abc")'],
+);
+
+my @inc = map { "-I$_" } grep { ! ref $_ } @INC;
+foreach my $case (@cases) {
+    my ($name, @args) = @{$case};
+    my $min;
+    for (1..$count) {
+        my $start = time;
+        system($Config{perlpath}, @inc, @args) == 0
+            or die "$name: failed: $?\n";
+        my $elapsed = time - $start;
+        $min = $elapsed unless defined $min and $min <= $elapsed;
+    }
+    printf "%-28s %8.2f ms\n", $name, $min * 1000;
+}
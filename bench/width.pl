@@ -0,0 +1,39 @@
+#! perl
+#
+# Measures throughput of sizing by UAX #11 on East Asian texts, in both
+# contexts.
+#
+# Usage: perl -Mblib bench/width.pl [FILE ...]
+#
+# Files are UTF-8 texts; test-data/{ja,ko,zh}*.in by default.
+#
+
+use strict;
+use warnings;
+use Time::HiRes qw(time);
+use Unicode::LineBreak;
+
+my @files = scalar @ARGV ? @ARGV : glob 'test-data/{ja,ko,zh}*.in';
+die "No input files\n" unless scalar @files;
+
+foreach my $file (@files) {
+    open my $fh, '<:encoding(UTF-8)', $file or die "$file: $!\n";
+    my $text = do { local $/; <$fh> };
+    close $fh;
+    $text x= int(1_000_000 / (length($text) || 1)) + 1;
+
+    foreach my $context (qw(EASTASIAN NONEASTASIAN)) {
+        my $lb = Unicode::LineBreak->new(Context => $context);
+        my $start = time;
+        my $prep = $lb->prepare($text);
+        my $elapsed = time - $start;
+        printf "%-24s %-12s %8.2f Mchars/s prepare\n", $file, $context,
+            length($text) / $elapsed / 1e6;
+
+        $start = time;
+        scalar $prep->measure(ColMax => $_) foreach (20, 40, 60, 80);
+        $elapsed = time - $start;
+        printf "%-24s %-12s %8.2f Mchars/s measure\n", $file, $context,
+            4 * length($text) / $elapsed / 1e6;
+    }
+}
@@ -42,7 +42,6 @@ our @ISA = qw(Exporter Unicode::LineBreak);
 ### Other modules:
 use Carp qw(croak carp);
 use Encode qw(is_utf8);
-use MIME::Charset;
 use Unicode::LineBreak qw(:all);
 
 ### Globals
@@ -127,6 +126,24 @@ my %FORMAT_FUNCS = (
     },
 );
 
+# Sizing method: Horizontal tab is treated as tab stop.
+my $SIZING_FUNC = sub {
+    my ($self, $cols, $pre, $spc, $str) = @_;
+
+    my $tabsize = $self->{TabSize};
+    my $spcstr = $spc.$str;
+    $spcstr->pos(0);
+    while (!$spcstr->eos and $spcstr->item->lbc == LB_SP) {
+        my $c = $spcstr->next;
+        if ($c eq "\t") {
+            $cols += $tabsize - $cols % $tabsize if $tabsize;
+        } else {
+            $cols += $c->columns;
+        }
+    }
+    return $cols + $spcstr->columns($spcstr->pos);
+};
+
 =head2 Public Interface
 
 =over 4
@@ -234,6 +251,7 @@ sub config {
     }
 
     # Set config.
+    my $lbclass = ! exists $self->{_charset};
     my @o = ();
     while (scalar @_) {
         my $k = shift;
@@ -244,11 +262,13 @@ sub config {
             $newline = $v;
         } else {
             push @o, $k => $v;
+            $lbclass = 1 if uc $k eq uc 'LBClass' or uc $k eq uc 'TailorLB';
         }
     }
     $self->SUPER::config(@o) if scalar @o;
 
     # Character set and language assumed.
+    require MIME::Charset;
     if (ref $self->{Charset} eq 'MIME::Charset') {
         $self->{_charset} = $self->{Charset};
     } else {
@@ -271,25 +291,11 @@ sub config {
                                  Language => $self->{Language}));
 
     ## Set sizing method.
-    $self->SUPER::config(Sizing => sub {
-        my ($self, $cols, $pre, $spc, $str) = @_;
-
-        my $tabsize = $self->{TabSize};
-        my $spcstr = $spc.$str;
-        $spcstr->pos(0);
-        while (!$spcstr->eos and $spcstr->item->lbc == LB_SP) {
-            my $c = $spcstr->next;
-            if ($c eq "\t") {
-                $cols += $tabsize - $cols % $tabsize if $tabsize;
-            } else {
-                $cols += $c->columns;
-            }
-        }
-        return $cols + $spcstr->substr($spcstr->pos)->columns;
-    });
+    $self->SUPER::config(Sizing => $SIZING_FUNC);
 
     ## Classify horizontal tab as line breaking class SP.
-    $self->SUPER::config(LBClass => [ord("\t") => LB_SP]);
+    ## Tailoring is kept unless LBClass option was updated.
+    $self->SUPER::config(LBClass => [ord("\t") => LB_SP]) if $lbclass;
     ## Tab size
     if (defined $self->{TabSize}) {
         croak "Invalid TabSize option" unless $self->{TabSize} =~ /^\d+$/;
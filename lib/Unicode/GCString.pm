@@ -33,7 +33,8 @@ use overload
     '${}' => \&as_scalarref,
     '""' => \&as_string,
     '.' => \&concat,
-    #XXX'.=' => \&concat, #FIXME:segfault
+    '.=' => \&concat,
+    '=' => sub { $_[0]->copy },
     'cmp' => \&cmp,
     '<>' => \&next,
     ;
@@ -46,7 +47,7 @@ sub new {
         $self = __PACKAGE__->_new(@_);
     } else {
         my $str = shift;
-        my $lb = Unicode::LineBreak->new(@_);
+        my $lb = Unicode::LineBreak->cached(@_);
         $self = __PACKAGE__->_new($str, $lb);
     }
     bless $self, $class;
@@ -6,7 +6,7 @@ require 5.008;
 ### Pragmas:
 use strict;
 use warnings;
-use vars qw($VERSION @EXPORT_OK @ISA $Config @Config);
+use vars qw($VERSION @EXPORT_OK @ISA $Config @Config $CacheSize);
 
 ### Exporting:
 use Exporter;
@@ -18,8 +18,6 @@ our @ISA = qw(Exporter);
 
 ### Other modules:
 use Carp qw(croak carp);
-use Encode qw(is_utf8);
-use MIME::Charset;
 use Unicode::GCString;
 
 ### Globals
@@ -39,6 +37,7 @@ our @Config = (
     Format => 'SIMPLE',
     HangulAsAL => 'NO',
     LBClass => undef,
+    Layout => 'GREEDY',
     LegacyCM => 'YES',
     Newline => "\n",
     Prep => undef,
@@ -50,6 +49,9 @@ our $Config = {};
 eval { require Unicode::LineBreak::Defaults; };
 push @Config, (%$Config);
 
+### Maximum number of profiles cached by cached()
+our $CacheSize = 32;
+
 ### Exportable constants
 use Unicode::LineBreak::Constants;
 use constant 1.01;
@@ -62,19 +64,10 @@ push @{$EXPORT_TAGS{'all'}}, @consts;
 require XSLoader;
 XSLoader::load('Unicode::LineBreak', $VERSION);
 
-### Load dynamic constants
-foreach my $p ((['EA', EAWidths()], ['LB', LBClasses()])) {
-    my $prop = shift @{$p};
-    my $idx = 0;
-    foreach my $val (@{$p}) {
-        no strict;
-        my $const = "${prop}_${val}";
-        *{$const} = eval "sub { $idx }";
-        push @EXPORT_OK, $const;
-        push @{$EXPORT_TAGS{'all'}}, $const;
-        $idx++;
-    }
-}
+### Dynamic constants (defined by XS module)
+my @dynconsts = ((map {"EA_$_"} EAWidths()), (map {"LB_$_"} LBClasses()));
+push @EXPORT_OK, @dynconsts;
+push @{$EXPORT_TAGS{'all'}}, @dynconsts;
 
 ### Privates
 my $EASTASIAN_CHARSETS = qr{
@@ -95,6 +88,10 @@ my $EASTASIAN_LANGUAGES = qr{
     ^ZH\b | ^CHI
 }ix;
 
+my %CACHE = ();
+my $CACHE_TICK = 0;
+my %CACHE_STATS = (Hits => 0, Misses => 0);
+
 use overload
     '%{}' => \&as_hashref,
     '${}' => \&as_scalarref,
@@ -110,6 +107,115 @@ sub new {
     bless $self, $class;
 }
 
+sub freeze {
+    my $self = shift;
+
+    if (ref $self) {
+        $self->config(@_) if scalar @_;
+    } else {
+        $self = $self->new(@_);
+    }
+    $self->_freeze;
+    $self;
+}
+
+sub clone {
+    my $self = shift;
+
+    my $clone = $self->_clone;
+    bless $clone, ref $self;
+    $clone->config(@_) if scalar @_;
+    $clone;
+}
+
+sub document {
+    my $self = shift;
+
+    require Unicode::LineBreak::Document;
+    Unicode::LineBreak::Document->new($self, @_);
+}
+
+sub classify {
+    my $self = (scalar @_ < 2) ? __PACKAGE__ : shift;
+
+    $self = $self->cached unless ref $self;
+    $self->_classify(@_);
+}
+
+sub load {
+    my $class = shift;
+    my $file = shift;
+
+    bless $class->_load($file), $class;
+}
+
+sub cached {
+    my $class = shift;
+
+    my $key = join "\0", $class, _cache_key(@Config, @_);
+    my $ent = $CACHE{$key};
+    if ($ent) {
+        $CACHE_STATS{Hits}++;
+        $ent->[1] = ++$CACHE_TICK;
+        return $ent->[0];
+    }
+    $CACHE_STATS{Misses}++;
+
+    my $self = $class->freeze(@_);
+    return $self unless $CacheSize and 0 < $CacheSize;
+    while ($CacheSize <= scalar keys %CACHE) {
+        # Least recently used entry has the smallest tick.
+        my ($lru, $tick);
+        while (my ($k, $v) = each %CACHE) {
+            ($lru, $tick) = ($k, $v->[1])
+                unless defined $tick and $tick <= $v->[1];
+        }
+        delete $CACHE{$lru};
+    }
+    $CACHE{$key} = [$self, ++$CACHE_TICK];
+    $self;
+}
+
+sub cache_stats {
+    return {%CACHE_STATS, Entries => scalar keys %CACHE};
+}
+
+sub clear_cache {
+    %CACHE = ();
+    %CACHE_STATS = (Hits => 0, Misses => 0);
+}
+
+# Canonical string of option list.  Names of options are case-insensitive
+# while their order is significant.  References are compared by contents
+# except code references and objects other than GCString.
+sub _cache_key {
+    my @key = ();
+    while (scalar @_) {
+        my $k = shift;
+        my $v = shift;
+        push @key, uc($k) . '=' . _cache_val($v);
+    }
+    join "\0", @key;
+}
+
+sub _cache_val {
+    my $v = shift;
+
+    if (! defined $v) {
+        return 'u';
+    } elsif (! ref $v) {
+        return 's' . length($v) . ':' . $v;
+    } elsif (ref $v eq 'ARRAY') {
+        return '[' . join(',', map { _cache_val($_) } @{$v}) . ']';
+    } elsif (ref $v eq 'Regexp') {
+        return 'r' . "$v";
+    } elsif (ref $v eq 'Unicode::GCString') {
+        return 'g' . _cache_val($v->as_string);
+    } else {
+        return 'p' . overload::StrVal($v);
+    }
+}
+
 sub config ($@) {
     my $self = shift;
 
@@ -228,6 +334,7 @@ sub context (@) {
             if (ref $opts{$k}) {
                 $charset = $opts{$k}->as_string;
             } else {
+                require MIME::Charset;
                 $charset = MIME::Charset->new($opts{$k})->as_string;
             }
         } elsif (uc $k eq 'LANGUAGE') {
@@ -0,0 +1,229 @@
+#-*- perl -*-
+
+package Unicode::LineBreak::Document;
+require 5.008;
+
+### Pragmas:
+use strict;
+use warnings;
+use vars qw($VERSION);
+
+### Other modules:
+use Carp qw(croak);
+use Unicode::LineBreak;
+
+### Globals
+
+### The package version
+our $VERSION = '2019.001';
+
+### Privates
+
+# End of paragraph: mandatory breaks by BK, CR, LF and NL.
+my $EOP = qr{\r\n|[\n\r\x0B\x0C\x{85}\x{2028}\x{2029}]};
+
+# Paragraphs are kept as [TEXT, [LINES], START, LINE] where TEXT includes
+# its newline, START is offset of TEXT and LINE is index of its first line.
+# An edit shifts START and LINE of all paragraphs after it, so the shift is
+# kept pending: START and LINE of paragraphs from index {dirty} lack
+# {dchars} and {dlines}.
+
+sub new {
+    my $class = shift;
+    my $lb = shift;
+    my $text = shift;
+
+    $text = '' unless defined $text;
+    my $self = bless {
+        paras => [],
+        pos => {},
+        dirty => 0,
+        dchars => 0,
+        dlines => 0,
+        length => 0,
+        nlines => 0,
+    }, $class;
+
+    # Paragraphs are broken separately.  Format callback should see the
+    # events of whole text: "sot" and "eot" only at the ends of text.
+    my $format = $lb->config('Format');
+    if (ref $format eq 'CODE') {
+        my $pos = $self->{pos};
+        $self->{lb} = $lb->clone(Format => sub {
+            my ($lb, $event, $str) = @_;
+            $event = 'sop' if $event eq 'sot' and !$pos->{first};
+            $event = 'eop' if $event eq 'eot' and !$pos->{last};
+            $format->($lb, $event, $str);
+        });
+    } else {
+        $self->{lb} = $lb->copy;
+    }
+
+    $self->{paras} = [$self->_paragraphs("$text", 0, 0, 1, 1)];
+    $self->{length} = length $text;
+    $self->{nlines} += scalar @{$_->[1]} foreach @{$self->{paras}};
+    $self;
+}
+
+# Break TEXT starting at offset START and line LINE into paragraphs.  FIRST
+# and LAST tell whether it is at beginning and end of the whole text.
+sub _paragraphs {
+    my $self = shift;
+    my ($text, $start, $line, $first, $last) = @_;
+
+    my @paras = ();
+    while ($text =~ /\G((?:(?!$EOP).)*(?:$EOP)?)/gs) {
+        last unless length $1;
+        push @paras, [$1, undef, $start, undef];
+        $start += length $1;
+    }
+    foreach my $i (0..$#paras) {
+        $self->{pos}->{first} = ($first and $i == 0);
+        $self->{pos}->{last} = ($last and $i == $#paras);
+        $paras[$i]->[1] = [$self->{lb}->break($paras[$i]->[0])];
+        $paras[$i]->[3] = $line;
+        $line += scalar @{$paras[$i]->[1]};
+    }
+    @paras;
+}
+
+# Offset and line index of I-th paragraph.
+sub _start {
+    my $self = shift;
+    my $i = shift;
+
+    my $para = $self->{paras}->[$i];
+    return ($para->[2], $para->[3]) if $i < $self->{dirty};
+    ($para->[2] + $self->{dchars}, $para->[3] + $self->{dlines});
+}
+
+# Index of the last paragraph starting before OFFSET, or at OFFSET unless
+# STRICT.  -1 if there are none.
+sub _find {
+    my $self = shift;
+    my $offset = shift;
+    my $strict = shift;
+
+    my ($lo, $hi) = (0, scalar @{$self->{paras}});
+    while ($lo < $hi) {
+        my $mid = ($lo + $hi) >> 1;
+        my ($start) = $self->_start($mid);
+        if ($start < $offset or (!$strict and $start == $offset)) {
+            $lo = $mid + 1;
+        } else {
+            $hi = $mid;
+        }
+    }
+    $lo - 1;
+}
+
+# Make offsets of paragraphs before index DIRTY exact and the others
+# pending.
+sub _settle {
+    my $self = shift;
+    my $dirty = shift;
+
+    my $paras = $self->{paras};
+    my ($dchars, $dlines) = @{$self}{qw(dchars dlines)};
+    for (my $i = $self->{dirty}; $i < $dirty; $i++) {
+        $paras->[$i]->[2] += $dchars;
+        $paras->[$i]->[3] += $dlines;
+    }
+    for (my $i = $dirty; $i < $self->{dirty} and $i <= $#{$paras}; $i++) {
+        $paras->[$i]->[2] -= $dchars;
+        $paras->[$i]->[3] -= $dlines;
+    }
+    $self->{dirty} = $dirty;
+}
+
+sub lines {
+    my $self = shift;
+
+    return map { @{$_->[1]} } @{$self->{paras}} if wantarray;
+    $self->{nlines};
+}
+
+sub text {
+    my $self = shift;
+
+    join '', map { $_->[0] } @{$self->{paras}};
+}
+
+sub edit {
+    my $self = shift;
+    my $offset = shift;
+    my $length = shift || 0;
+    my $replacement = shift;
+    $replacement = '' unless defined $replacement;
+
+    my $paras = $self->{paras};
+    my $total = $self->{length};
+    croak "edit: Offset out of range"
+        unless defined $offset and 0 <= $offset and $offset <= $total;
+    croak "edit: Length out of range"
+        unless 0 <= $length and $offset + $length <= $total;
+
+    # Find paragraphs to be edited: FIRST..LAST.
+    my $first = $self->_find($offset);
+    $first = 0 if $first < 0;
+    my $last = $self->_find($offset + $length, 1);
+    $last = $first if $last < $first and scalar @{$paras};
+    my ($start, $line) = scalar @{$paras} ? $self->_start($first) : (0, 0);
+
+    # Edit text.  If newline was lost or CR and LF meet, adjacent
+    # paragraphs join.
+    my $text = join '', map { $_->[0] } @{$paras}[$first..$last];
+    my $oldlength = length $text;
+    substr($text, $offset - $start, $length) = "$replacement";
+    while ($last < $#{$paras} and
+           ($text !~ /$EOP\z/ or
+            ($text =~ /\r\z/ and $paras->[$last + 1]->[0] =~ /^\n/))) {
+        $text .= $paras->[++$last]->[0];
+        $oldlength += length $paras->[$last]->[0];
+    }
+    if (0 < $first and $text =~ /^\n/ and $paras->[$first - 1]->[0] =~ /\r\z/) {
+        $first--;
+        $text = $paras->[$first]->[0] . $text;
+        $oldlength += length $paras->[$first]->[0];
+        ($start, $line) = $self->_start($first);
+    }
+    # If edited paragraphs vanish, neighbour may become the first or the
+    # last one.
+    if (!length $text) {
+        if (0 < $first and $last == $#{$paras}) {
+            $first--;
+            $text = $paras->[$first]->[0];
+            $oldlength += length $text;
+            ($start, $line) = $self->_start($first);
+        } elsif ($first == 0 and $last < $#{$paras}) {
+            $text = $paras->[++$last]->[0];
+            $oldlength += length $text;
+        }
+    }
+
+    # Break edited paragraphs and find range of changed lines.
+    $self->_settle($last + 1);
+    my @old = map { @{$_->[1]} } @{$paras}[$first..$last];
+    my @new = $self->_paragraphs($text, $start, $line, $first == 0,
+                                 $last >= $#{$paras});
+    splice @{$paras}, $first, $last - $first + 1, @new;
+    $self->{dirty} = $first + scalar @new;
+    @new = map { @{$_->[1]} } @new;
+    $self->{dchars} += length($text) - $oldlength;
+    $self->{dlines} += scalar @new - scalar @old;
+    $self->{length} += length($text) - $oldlength;
+    $self->{nlines} += scalar @new - scalar @old;
+
+    while (scalar @old and scalar @new and "$old[0]" eq "$new[0]") {
+        shift @old;
+        shift @new;
+        $line++;
+    }
+    while (scalar @old and scalar @new and "$old[-1]" eq "$new[-1]") {
+        pop @old;
+        pop @new;
+    }
+    return ($line, scalar @old, @new);
+}
+
+1;
@@ -0,0 +1,49 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 12 }
+
+my $lb = Unicode::LineBreak->new(LBClass => [[[0x4E00, 0x9FFF]] => LB_AL()]);
+is_deeply($lb->config('LBClassRanges'), [[[[0x4E00, 0x9FFF]] => LB_AL()]],
+	  'LBClassRanges');
+is(scalar @{$lb->config('LBClass')->[0]->[0]}, 0x9FFF - 0x4E00 + 1,
+   'LBClass by characters');
+is_deeply($lb->config('EAWidthRanges'), [[[[0x302E, 0x302F]] => EA_Z()]],
+	  'EAWidthRanges merges adjacent characters');
+
+my $lb1 = Unicode::LineBreak->new(LBClass => [KANA_NONSTARTERS() => LB_ID()]);
+my $lb2 = Unicode::LineBreak->new(map { (LBClass => $_) }
+				  @{$lb1->config('LBClassRanges')});
+is_deeply($lb2->config('LBClass'), $lb1->config('LBClass'), 'round trip');
+is_deeply($lb2->config('LBClassRanges'), $lb1->config('LBClassRanges'),
+	  'round trip by ranges');
+dotest('ja-k', 'ja-k.ns', map { (LBClass => $_) }
+       @{$lb1->config('LBClassRanges')});
+
+is(Unicode::GCString->new('ABC', EAWidth => [[[0x41, 0x5A]] => EA_W()])
+   ->columns, 6, 'EAWidth by range');
+is(Unicode::GCString->new('ABC', EAWidth => [[0x41, [0x42, 0x43]] => EA_W()])
+   ->columns, 6, 'EAWidth by characters and range');
+
+$lb = Unicode::LineBreak->new(LBClass => [[[0x20000, 0x3FFFD]] => LB_AL()]);
+is_deeply($lb->config('LBClassRanges'), [[[[0x20000, 0x3FFFD]] => LB_AL()]],
+	  'large range is one entry');
+is(Unicode::GCString->new("\x{2A6D6}", $lb)->lbc, LB_AL(),
+   'large range is effective');
+
+$lb = Unicode::LineBreak->new(EAWidth => [[[0x41, 0x5A]] => EA_W()],
+			      LBClass => [[[0x50, 0x60]] => LB_ID()],
+			      LBClass => [[[0x55, 0x57]] => LB_AL()]);
+is_deeply($lb->config('EAWidthRanges'),
+	  [[[[0x41, 0x5A]] => EA_W()], [[[0x302E, 0x302F]] => EA_Z()]],
+	  'overlapping ranges keep other property');
+is_deeply($lb->config('LBClassRanges'),
+	  [[[[0x50, 0x54]] => LB_ID()], [[[0x55, 0x57]] => LB_AL()],
+	   [[[0x58, 0x60]] => LB_ID()]],
+	  'range splits existing ones');
+
+1;
@@ -0,0 +1,50 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 15 }
+
+my $profile = Unicode::LineBreak->freeze(ColMax => 20,
+					 LBClass => [ord('$') => LB_AL()]);
+ok($profile->frozen, 'freeze');
+is($profile->config('ColMax'), 20, 'freeze with options');
+eval { $profile->config(ColMax => 30) };
+like($@, qr/frozen/, 'frozen object cannot be configured');
+eval { $profile->break_partial('abc') };
+like($@, qr/frozen/, 'frozen object cannot be broken partially');
+eval { $profile->reset };
+like($@, qr/frozen/, 'frozen object cannot be reset');
+
+my $clone = $profile->clone(ColMax => 30);
+ok(!$clone->frozen, 'clone is not frozen');
+is($clone->config('ColMax'), 30, 'clone with overrides');
+is($profile->config('ColMax'), 20, 'overrides do not affect profile');
+is_deeply($clone->config('LBClass'), $profile->config('LBClass'),
+	  'clone shares tailoring map');
+
+$clone->config(LBClass => [ord('#') => LB_AL()]);
+is(scalar @{$clone->config('LBClass')->[0]->[0]}, 2,
+   'tailoring of clone');
+is(scalar @{$profile->config('LBClass')->[0]->[0]}, 1,
+   'tailoring of clone does not affect profile');
+
+undef $profile;
+is_deeply($clone->config('LBClass'), [[[ord('#'), ord('$')] => LB_AL()]],
+	  'clone survives profile');
+
+$profile = Unicode::LineBreak->freeze(LBClass => [ord('$') => LB_AL()]);
+my $gcstr = Unicode::GCString->new('$', $profile->clone);
+undef $profile;
+is($gcstr->lbc, LB_AL(), 'string survives profile and clone');
+
+$clone = $clone->clone;
+$clone->{foo} = 'bar';
+my $clone2 = $clone->clone;
+is($clone2->{foo}, 'bar', 'clone copies hash');
+$clone2->{foo} = 'baz';
+is($clone->{foo}, 'bar', 'hash of clone is independent');
+
+1;
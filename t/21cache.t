@@ -0,0 +1,44 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 10 }
+
+Unicode::LineBreak->clear_cache;
+
+my $lb1 = Unicode::LineBreak->cached(ColMax => 20, LBClass => [0x24 => LB_AL()]);
+my $lb2 = Unicode::LineBreak->cached(colmax => 20, LBClass => [0x24 => LB_AL()]);
+my $lb3 = Unicode::LineBreak->cached(ColMax => 20, LBClass => [0x24 => LB_ID()]);
+ok($lb1->frozen, 'cached object is frozen');
+is("$lb1", "$lb2", 'cache hit');
+isnt("$lb1", "$lb3", 'cache miss');
+is_deeply(Unicode::LineBreak->cache_stats,
+	  {Hits => 1, Misses => 2, Entries => 2}, 'statistics');
+
+{
+    local $Unicode::LineBreak::CacheSize = 2;
+    Unicode::LineBreak->cached(ColMax => 20, LBClass => [0x24 => LB_AL()]);
+    Unicode::LineBreak->cached(ColMax => 30);
+    is(Unicode::LineBreak->cache_stats->{Entries}, 2, 'eviction');
+    Unicode::LineBreak->cached(ColMax => 20, LBClass => [0x24 => LB_AL()]);
+    Unicode::LineBreak->cached(ColMax => 20, LBClass => [0x24 => LB_ID()]);
+    is(Unicode::LineBreak->cache_stats->{Misses}, 4,
+       'least recently used one was evicted');
+}
+
+Unicode::LineBreak->clear_cache;
+my @gcstr = map { Unicode::GCString->new("\x{3042}", EAWidth => [0x3042 => EA_N()]) }
+	    1..3;
+is($gcstr[2]->columns, 1, 'GCString with options');
+is_deeply(Unicode::LineBreak->cache_stats,
+	  {Hits => 2, Misses => 1, Entries => 1}, 'GCString uses cache');
+
+my $lb = Unicode::LineBreak->cached(ColMax => 20)->clone(ColMax => 30);
+is($lb->config('ColMax'), 30, 'clone of cached object');
+is(Unicode::LineBreak->cached(ColMax => 20)->config('ColMax'), 20,
+   'cached object is not affected');
+
+1;
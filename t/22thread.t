@@ -0,0 +1,58 @@
+use strict;
+use Config;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+
+BEGIN {
+    if (! $Config{'useithreads'}) {
+	plan skip_all => 'Perl not compiled with useithreads';
+    } else {
+	plan tests => 9;
+    }
+}
+
+use threads;
+require "t/lb.pl";
+
+my $lb = Unicode::LineBreak->new(ColMax => 10, Format => 'NEWLINE',
+				 LBClass => [0x24 => LB_ID()],
+				 Sizing => sub { shift; return shift() +
+				     Unicode::GCString->new(join '', @_)
+				     ->columns });
+$lb->{foo} = 'bar';
+my $gcstr = Unicode::GCString->new('$$', $lb);
+my $expected = $lb->break("foo bar baz quux\n");
+my $prepared = $lb->prepare("foo bar baz quux\n");
+$lb->break_partial("foo bar ");
+
+my @threads = map {
+    threads->create(sub {
+	my @r = ();
+	push @r, scalar $lb->break("foo bar baz quux\n");
+	push @r, $lb->{foo};
+	push @r, $gcstr->lbc;
+	my $clone = $lb->clone(LBClass => [0x23 => LB_ID()]);
+	push @r, scalar @{$clone->config('LBClass')->[0]->[0]};
+	push @r, $lb->break_partial("baz quux\n") . $lb->break_partial(undef);
+	push @r, scalar $prepared->layout;
+	join "\0", @r;
+    });
+} 1..2;
+my @r = map { $_->join } @threads;
+
+is($r[0], $r[1], 'threads');
+my @r0 = split /\0/, $r[0], -1;
+is($r0[0], $expected, 'break in thread');
+is($r0[1], 'bar', 'hash is copied');
+is($r0[2], LB_ID(), 'string refers copied object');
+is($r0[3], 2, 'tailoring in thread');
+is($r0[4], $expected, 'partial input is copied');
+is($r0[5], $expected, 'prepared text is copied');
+is(scalar @{$lb->config('LBClass')->[0]->[0]}, 1,
+   'tailoring in thread does not affect parent');
+is($lb->break_partial("baz quux\n") . $lb->break_partial(undef), $expected,
+   'partial input of parent');
+
+1;
@@ -0,0 +1,58 @@
+use strict;
+use Test::More;
+use Config;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 14 }
+
+my $file = "$FindBin::Bin/profile.$$.tmp";
+END { unlink $file if defined $file; }
+
+my $lb = Unicode::LineBreak->new(ColMax => 20, ColMin => 5, Format => 'TRIM',
+				 Newline => "\r\n", Prep => 'NONBREAKURI',
+				 Urgent => 'FORCE',
+				 LBClass => [[[0x24, 0x26]] => LB_ID()],
+				 EAWidth => [0x3042 => EA_N()]);
+$lb->compile($file);
+
+my $profile = Unicode::LineBreak->load($file);
+ok($profile->frozen, 'loaded profile is frozen');
+foreach my $k (qw(ColMax ColMin Format Newline Prep Urgent LBClass EAWidth)) {
+    is_deeply($profile->config($k), $lb->config($k), $k);
+}
+
+my $clone = $profile->clone;
+$clone->config(LBClass => [0x27 => LB_ID()]);
+is_deeply($profile->config('LBClassRanges'), [[[[0x24, 0x26]] => LB_ID()]],
+	  'tailoring of clone does not affect profile');
+
+$clone = $profile->clone;
+my $gcstr = Unicode::GCString->new('$', $profile);
+undef $profile;
+is_deeply($clone->config('LBClassRanges'), [[[[0x24, 0x26]] => LB_ID()]],
+	  'clone survives profile');
+is($gcstr->lbc, LB_ID(), 'string survives profile');
+
+eval {
+    Unicode::LineBreak->new(Format => sub { undef })->compile($file);
+};
+like($@, qr/Can't compile/, 'subroutine can not be compiled');
+
+# Size of map wrapping around is detected: 12 * 2**62 is 0 modulo 2**64.
+$lb->compile($file);
+open my $fh, '+<', $file or die $!;
+binmode $fh;
+my $buf = do { local $/; <$fh> };
+my $size = $Config::Config{sizesize};
+my $fmt = {4 => 'L', 8 => 'Q'}->{$size};
+my $pos = index $buf, pack($fmt, length $buf);
+seek $fh, $pos - $size, 0;	# mapsiz precedes filelen.
+print $fh pack($fmt, 1 << ($size * 8 - 2));
+close $fh;
+eval { Unicode::LineBreak->load($file) };
+like($@, qr/Broken profile/, 'broken profile');
+
+1;
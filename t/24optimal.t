@@ -0,0 +1,112 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 16 }
+
+my $text = "aaa bb cc ddddd\naaa bb cc ddddd";
+my %opts = (ColMax => 6, Format => 'NEWLINE');
+
+my $lb = Unicode::LineBreak->new(%opts);
+is($lb->config('Layout'), 'GREEDY', 'default layout');
+is($lb->break($text), "aaa bb\ncc\nddddd\naaa bb\ncc\nddddd\n", 'greedy');
+
+$lb = Unicode::LineBreak->new(%opts, Layout => 'OPTIMAL');
+is($lb->config('Layout'), 'OPTIMAL', 'optimal layout');
+is($lb->break($text), "aaa\nbb cc\nddddd\naaa\nbb cc\nddddd\n", 'optimal');
+is(scalar(my @lines = $lb->break($text)), 6, 'array context');
+
+my @events = ();
+$lb = Unicode::LineBreak->new(ColMax => 6, Layout => 'OPTIMAL',
+			      Format => sub { push @events, $_[1]; undef });
+is($lb->break($text), $text, 'format callback');
+is(join(',', @events),
+   'sot,,eol,sol,,eol,sol,,eop,sop,,eol,sol,,eol,sol,,eot',
+   'events of format callback');
+
+$lb = Unicode::LineBreak->new(%opts, Layout => 'OPTIMAL',
+			      Sizing => sub { $_[1] + length("$_[3]$_[4]") });
+is($lb->break($text), "aaa\nbb cc\nddddd\naaa\nbb cc\nddddd\n",
+   'sizing callback');
+
+$lb = Unicode::LineBreak->new(%opts, Layout => 'OPTIMAL', Urgent => 'FORCE');
+is($lb->break("aaaaaaaaaaaaaa bb"), "aaaaaa\naaaaaa\naa bb\n",
+   'urgent breaking');
+$lb->config(Urgent => 'CROAK');
+eval { $lb->break("aaaaaaaaaaaaaa bb") };
+like($@, qr/Excessive/, 'urgent breaking croaks');
+
+$lb->config(Urgent => sub { bless {}, 'Foo' });
+eval { $lb->break("aaaaaaaaaaaaaa bb") };
+like($@, qr/Unknown object/, 'croak in urgent breaking is propagated');
+$lb->config(Urgent => undef);
+is($lb->break("aaaaaaaaaaaaaa bb"), "aaaaaaaaaaaaaa\nbb\n",
+   'object is usable after croak');
+
+# Demerits of lines by total-fit algorithm, set ragged right.
+sub demerits {
+    my ($colmax, $colmin, @lines) = @_;
+    my ($sum, $prev) = (0, undef);
+    foreach my $i (0..$#lines) {
+	my $cols = Unicode::GCString->new($lines[$i])->columns;
+	my $b = 0;
+	if ($colmax < $cols or ($i < $#lines and $cols < $colmin)) {
+	    $b = 10000;
+	} elsif ($i < $#lines) {
+	    $b = 100 * (($colmax - $cols) / $colmax) ** 3;
+	}
+	my $fit = ($b < 13) ? 2 : ($b < 100) ? 1 : 0;
+	$sum += (10 + $b) ** 2;
+	$sum += 10000 if defined $prev and 1 < abs($prev - $fit);
+	$prev = $fit;
+    }
+    return $sum;
+}
+
+# Every way to join fragments into lines.
+sub layouts {
+    my @frags = @_;
+    return ([]) unless @frags;
+    my @ret;
+    foreach my $n (1..scalar @frags) {
+	my $line = join '', @frags[0..$n - 1];
+	$line =~ s/ +$//;
+	push @ret, map { [$line, @$_] } layouts(@frags[$n..$#frags]);
+    }
+    return @ret;
+}
+
+srand 24;
+my ($worse, $total) = (0, 0);
+foreach my $colmin (0, 4) {
+    my $lb = Unicode::LineBreak->new(ColMax => 10, ColMin => $colmin,
+				     Format => undef, Layout => 'OPTIMAL');
+    my $frag = Unicode::LineBreak->new(ColMax => 1, Format => undef);
+    foreach (1..30) {
+	my $text = join ' ',
+	    map { 'x' x (1 + int rand 6) } 1..(3 + int rand 6);
+	my @frags = map {"$_"} $frag->break($text);
+	my ($min) = sort { $a <=> $b }
+	    map { demerits(10, $colmin, grep { length } @$_) }
+	    grep { !grep { 10 < length } @$_ } layouts(@frags);
+	my @got = map { my $s = "$_"; $s =~ s/ +$//; $s } $lb->break($text);
+	$worse++ if $min + 1e-6 < demerits(10, $colmin, @got);
+	$total++;
+    }
+}
+is($worse, 0, "least demerits in $total paragraphs");
+
+my $prep = Unicode::LineBreak->new(%opts, Layout => 'OPTIMAL',
+				 Prep => [qr/aaa bb/, sub { ($_[1]) }]);
+is($prep->break("aaa bb cc ddddd"), "aaa bb\ncc\nddddd\n",
+   'user-defined breaking');
+is($prep->prepare("aaa bb cc ddddd")->layout, "aaa bb\ncc\nddddd\n",
+   'user-defined breaking by prepared text');
+
+eval { $lb->break_partial($text) };
+like($@, qr/OPTIMAL/, 'break_partial is not supported');
+
+1;
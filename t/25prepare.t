@@ -0,0 +1,61 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 19 }
+
+my $text = "aaa bb cc ddddd\naaa bb cc ddddd";
+my $lb = Unicode::LineBreak->new(ColMax => 6, Format => 'NEWLINE');
+my $prepared = $lb->prepare($text);
+isa_ok($prepared, 'Unicode::LineBreak::Prepared');
+
+foreach my $colmax (6, 10, 20) {
+    $lb->config(ColMax => $colmax);
+    is($prepared->layout(ColMax => $colmax), $lb->break($text),
+       "layout by $colmax columns");
+}
+is($prepared->layout, "aaa bb\ncc\nddddd\naaa bb\ncc\nddddd\n",
+   'configuration at the time of prepare');
+is($prepared->layout(Layout => 'OPTIMAL'),
+   "aaa\nbb cc\nddddd\naaa\nbb cc\nddddd\n", 'optimal layout');
+is(scalar(my @lines = $prepared->layout(ColMax => 10)), 4, 'array context');
+
+eval { $prepared->layout(Format => 'SIMPLE') };
+like($@, qr/Format/, 'options which can not be changed');
+
+$lb = Unicode::LineBreak->new(ColMax => 6, Format => 'NEWLINE',
+			      Urgent => 'FORCE',
+			      Sizing => sub { $_[1] + length("$_[3]$_[4]") });
+$prepared = $lb->prepare("aaaaaaaaaaaaaa bb cc");
+undef $lb;
+is($prepared->layout, "aaaaaa\naaaaaa\naa bb\ncc\n",
+   'urgent breaking and sizing callback');
+is($prepared->layout(ColMax => 20), "aaaaaaaaaaaaaa bb cc\n",
+   'urgent breaking depends on layout');
+
+$text = "aa bbbbbbbbbbb cc dd eeeeee ffff\ngg hhh";
+foreach my $urgent (undef, 'FORCE') {
+    $lb = Unicode::LineBreak->new(ColMax => 8, Format => 'NEWLINE',
+				  Urgent => $urgent);
+    $prepared = $lb->prepare($text);
+    foreach my $colmin (0, 3, 5, 8) {
+	$lb->config(ColMin => $colmin);
+	is($prepared->layout(ColMin => $colmin), $lb->break($text),
+	   "ColMin $colmin, Urgent " . ($urgent || 'none'));
+    }
+}
+
+$lb = Unicode::LineBreak->new(ColMax => 8, Urgent => 'FORCE', Format => sub {
+    my ($self, $event, $str) = @_;
+    return "> $str" if $event =~ /^so/;
+    return "\n" if $event =~ /^eo/;
+    undef;
+});
+$prepared = $lb->prepare($text);
+is($prepared->layout, $lb->break($text),
+   'text formatted at start of line is measured');
+
+1;
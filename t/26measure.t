@@ -0,0 +1,60 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 14 }
+
+sub columns {
+    map { my $s = "$_"; $s =~ s/\s+$//; Unicode::GCString->new($s)->columns }
+	@_;
+}
+
+my $text = "aaa bb cc ddddd\naaa bb cc ddddd  \n\x{3042}\x{3044} x";
+
+foreach my $layout (qw(GREEDY OPTIMAL)) {
+    my $lb = Unicode::LineBreak->new(ColMax => 6, Layout => $layout);
+    my @lines = $lb->break($text);
+    my ($n, $max, $cols) = $lb->measure($text);
+    is($n, scalar @lines, "number of lines ($layout)");
+    is_deeply([unpack 'd*', $cols], [columns(@lines)],
+	      "columns of lines ($layout)");
+}
+
+foreach my $colmin (3, 6) {
+    my $lb = Unicode::LineBreak->new(ColMax => 6, ColMin => $colmin,
+				     Urgent => 'FORCE');
+    my @lines = $lb->break($text);
+    my ($n, $max, $cols) = $lb->measure($text);
+    is($n, scalar @lines, "number of lines (ColMin $colmin)");
+    is_deeply([unpack 'd*', $cols], [columns(@lines)],
+	      "columns of lines (ColMin $colmin)");
+}
+
+# Runs longer than sixteen clusters, with tailored widths.
+{
+    my $lb = Unicode::LineBreak->new(ColMax => 60,
+				     EAWidth => [ord('a') => EA_W()]);
+    my $long = ('ab' x 20) . ' ' . ('a' x 17) . ' ' . ('b' x 33);
+    my @lines = $lb->break($long);
+    my ($n, $max, $cols) = $lb->measure($long);
+    is($n, scalar @lines, 'number of lines (long runs)');
+    is_deeply([unpack 'd*', $cols],
+	      [map { my $s = "$_"; $s =~ s/\s+$//;
+		     Unicode::GCString->new($s, $lb)->columns } @lines],
+	      'columns of lines (long runs)');
+}
+
+my $lb = Unicode::LineBreak->new(ColMax => 6);
+is(scalar $lb->measure($text), 7, 'scalar context');
+is(($lb->measure($text))[1], 6, 'maximum columns');
+
+my $prepared = $lb->prepare($text);
+$lb->config(ColMax => 10);
+is_deeply([($prepared->measure(ColMax => 10))[0, 1]],
+	  [($lb->measure($text))[0, 1]], 'prepared text');
+is(scalar $lb->measure(''), 0, 'empty string');
+
+1;
@@ -0,0 +1,73 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 15 }
+
+sub strings { map {"$_"} @_ }
+
+my $text = "aaa bb cc ddddd ee\nff ggg hhhh\r\niii jj kkkkk\n";
+my $lb = Unicode::LineBreak->new(ColMax => 8);
+my $doc = $lb->document($text);
+my @lines = strings($doc->lines);
+
+is_deeply([@lines], [strings($lb->break($text))], 'initial lines');
+is(scalar $doc->lines, scalar @lines, 'scalar context');
+
+sub check {
+    my ($offset, $length, $replacement, $name) = @_;
+
+    my ($first, $count, @new) = $doc->edit($offset, $length, $replacement);
+    splice @lines, $first, $count, strings(@new);
+    substr($text, $offset, $length) = $replacement;
+    is_deeply([@lines], [strings($lb->break($text))], $name);
+    ($first, $count, scalar @new);
+}
+
+is_deeply([check(19, 2, 'FF', 'edit in paragraph')], [3, 1, 1],
+	  'only changed line is returned');
+check(18, 1, ' ', 'paragraphs joined');
+check(4, 0, "\n", 'paragraph split');
+check(length($text) - 1, 1, ' zz', 'edit at end of text');
+check(length($text), 0, "\r", 'CR appended');
+check(28, 2, "\r", 'CR and LF');
+is($doc->text, $text, 'text');
+
+$lb->config(ColMax => 3);
+is_deeply([strings($doc->lines)], [@lines], 'options are copied');
+
+srand(1);
+my $ok = 1;
+$lb->config(ColMax => 8);
+foreach (1..200) {
+    my $offset = int rand(length($text) + 1);
+    my $length = int rand(length($text) - $offset + 1);
+    $length = 0 if 4 < $length;
+    my $replacement = join '',
+	map { (' ', 'a', 'bb', "\n", "\r")[int rand 5] } 1..int rand 4;
+    my ($first, $count, @new) = $doc->edit($offset, $length, $replacement);
+    splice @lines, $first, $count, strings(@new);
+    substr($text, $offset, $length) = $replacement;
+    $ok = 0 unless join("\0", @lines) eq join("\0", strings($lb->break($text)))
+	and scalar $doc->lines == scalar @lines;
+}
+ok($ok, 'random edits');
+
+$lb = Unicode::LineBreak->new(ColMax => 8, Format => sub {
+    my ($self, $event, $str) = @_;
+    return "$event>$str" if $event =~ /^so/;
+    return "<$event\n" if $event =~ /^eo/;
+    undef;
+});
+$text = "aaa bb cc\ndd eee\nff";
+$doc = $lb->document($text);
+@lines = strings($doc->lines);
+is_deeply([@lines], [strings($lb->break($text))],
+	  'Format callback sees events of whole text');
+check(length($text) - 3, 3, '', 'last paragraph removed');
+check(0, 10, '', 'first paragraph removed');
+
+1;
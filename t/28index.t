@@ -0,0 +1,74 @@
+use strict;
+use Test::More;
+use Config;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 15 }
+
+my $file = "$FindBin::Bin/index.$$.tmp";
+END { unlink $file if defined $file; }
+
+my $text = "aaa bb cc ddddd eeeeeeeeeeee f\n\n\x{3042}\x{3044}\x{3046} gg hh\r\niii";
+my $lb = Unicode::LineBreak->new(ColMax => 10, Urgent => 'FORCE');
+$lb->write_index($text, $file);
+ok(-s $file, 'index is written');
+
+my $prepared = $lb->prepare($text, $file);
+foreach my $colmax (5, 10, 20) {
+    $lb->config(ColMax => $colmax);
+    is_deeply([map {"$_"} $prepared->layout(ColMax => $colmax)],
+	      [map {"$_"} $lb->prepare($text)->layout],
+	      "layout by index ($colmax)");
+}
+$lb->config(Layout => 'OPTIMAL', ColMax => 10);
+is_deeply([map {"$_"} $lb->prepare($text, $file)->layout],
+	  [map {"$_"} $lb->prepare($text)->layout], 'optimal layout by index');
+
+$lb->config(Layout => 'GREEDY');
+$lb->write_index('', $file);
+is_deeply([$lb->prepare('', $file)->layout], [], 'empty string');
+
+$lb->write_index($text, $file);
+eval { $lb->prepare("$text.", $file) };
+like($@, qr/Made for another text/, 'another text');
+eval { $lb->clone(LBClass => [0x3042 => LB_AL()])->prepare($text, $file) };
+like($@, qr/Made with another configuration/, 'another configuration');
+my $clone = $lb->clone(ColMax => 3, Format => 'TRIM', Urgent => undef);
+is_deeply([map {"$_"} $clone->prepare($text, $file)->layout],
+	  [map {"$_"} $clone->prepare($text)->layout],
+	  'options not affecting analysis');
+
+# Index is kept mapped while prepared text refers to it.
+sub mappings {
+    open my $maps, '<', '/proc/self/maps' or return undef;
+    scalar grep { index($_, "index.$$.tmp") >= 0 } <$maps>;
+}
+SKIP: {
+    skip 'mappings of process are unknown', 4
+	unless $Config{d_mmap} and defined mappings();
+    $prepared = $lb->prepare($text, $file);
+    is(mappings(), 1, 'index is mapped');
+    undef $prepared;
+    is(mappings(), 0, 'index is unmapped');
+    eval { $lb->clone(Prep => [qr/x/, sub { }])->prepare($text, $file) };
+    like($@, qr/Prep option of regex/, 'index can not be used');
+    is(mappings(), 0, 'index is unmapped on croak');
+}
+$prepared = $lb->prepare($text, $file);
+unlink $file;
+$lb->config(ColMax => 10);
+is_deeply([map {"$_"} $prepared->layout],
+	  [map {"$_"} $lb->prepare($text)->layout], 'index file removed');
+$lb->write_index($text, $file);
+
+open my $fh, '+<', $file or die $!;
+binmode $fh;
+print $fh 'XXXXXXXX';
+close $fh;
+eval { $lb->prepare($text, $file) };
+like($@, qr/Not a break index/, 'broken index');
+
+1;
@@ -0,0 +1,101 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 12 }
+
+# 7-bit texts are converted by fast path.  Compare them with results of
+# general path, i.e. texts including other characters.
+
+srand 14;
+my @chars = ((map { chr } 0..127), ("\r\n", ' ', 'a', 'z') x 8);
+my @texts = map {
+    join '', map { $chars[rand @chars] } 1..(int rand 200)
+} 1..50;
+push @texts, join(' ', ('lorem ipsum') x 1000);
+
+my $lb = Unicode::LineBreak->new(ColMax => 20);
+my (@got, @expected);
+
+@got = map { Unicode::GCString->new($_)->as_string } @texts;
+is_deeply([@got], [@texts], 'round trip of byte strings');
+
+@got = map {
+    my $s = $_; utf8::upgrade($s); Unicode::GCString->new($s)->as_string
+} @texts;
+is_deeply([@got], [@texts], 'round trip of utf8 strings');
+
+@expected = map { "\x{3042}$_\x{10348}" } @texts;
+@got = map { Unicode::GCString->new($_)->as_string } @expected;
+is_deeply([@got], [@expected], 'round trip of non-7-bit strings');
+
+@got = map { [map {"$_"} $lb->break($_)] } @texts;
+@expected = map {
+    my @l = map {"$_"} $lb->break("\x{3042}\n$_");
+    shift @l;
+    [@l]
+} @texts;
+is_deeply([@got], [@expected], 'breaking');
+
+@got = map { [map { $_->columns } Unicode::GCString->new($_)->as_array] }
+    @texts;
+@expected = map {
+    my @c = map { $_->columns } Unicode::GCString->new("\x{3042}$_")->as_array;
+    shift @c;
+    [@c]
+} @texts;
+is_deeply([@got], [@expected], 'columns of clusters');
+
+# Long 7-bit texts are not segmented.  Compare properties of clusters with
+# those segmented by the library.
+
+sub clusters {
+    my $gcstr = shift;
+    my $offset = shift || 0;
+    [map {
+	my $c = $gcstr->substr($_, 1);
+	join ',', $c->as_string, $c->columns, $c->lbc, $c->lbcext
+    } $offset..$gcstr->length - 1];
+}
+
+my @long = map {
+    join '', map { $chars[rand @chars] } 1..(512 + int rand 1000)
+} 1..20;
+push @long, "\r\n" x 300, "a\r" x 300;
+foreach my $lbobj (undef,
+		   Unicode::LineBreak->new(LBClass => [ord('a') => LB_ID()],
+					   EAWidth => [ord('z') => EA_F()]),
+		   Unicode::LineBreak->new(Context => 'EASTASIAN')) {
+    my @lbobj = $lbobj ? ($lbobj) : ();
+    @got = map { clusters(Unicode::GCString->new($_, @lbobj)) } @long;
+    @expected = map {
+	clusters(Unicode::GCString->new("\x{3042}$_", @lbobj), 1)
+    } @long;
+    is_deeply([@got], [@expected],
+	      'properties of clusters' . ($lbobj ? ' with options' : ''));
+}
+# SPACE followed by control is a cluster under LegacyCM.
+my @spc = map {
+    join '', map { (' ', "\x01", "\t", 'a')[rand 4] } 1..(512 + int rand 100)
+} 1..20;
+foreach my $legacy (qw(YES NO)) {
+    my $lbobj = Unicode::LineBreak->new(LegacyCM => $legacy);
+    @got = map { clusters(Unicode::GCString->new($_, $lbobj)) } @spc;
+    @expected = map {
+	clusters(Unicode::GCString->new("\x{3042}$_", $lbobj), 1)
+    } @spc;
+    is_deeply([@got], [@expected], "SPACE and controls (LegacyCM $legacy)");
+}
+
+@got = map { Unicode::GCString->new($_)->length } @long[-2, -1];
+is_deeply([@got], [300, 600], 'CR LF is a cluster');
+
+my $gcstr = Unicode::GCString->new("ab\x{3042}cd\x{10348}e");
+is_deeply([map { $gcstr->substr($_, 2)->as_string } 0..6],
+	  ["ab", "b\x{3042}", "\x{3042}c", "cd", "d\x{10348}", "\x{10348}e",
+	   "e"], 'substrings');
+
+1;
@@ -0,0 +1,45 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 9 }
+
+# Long substrings share Unicode buffer with their parent until either of
+# them is modified.
+
+my $text = "Pe\x{0301}rl " . ("\x{3042}\x{3044}\x{3046} " x 100) . "\x{4E00}";
+my $gcs = Unicode::GCString->new($text);
+my @copies = map { $gcs->substr($_, 1) } 0..($gcs->length - 1);
+
+is_deeply([map {"$_"} $gcs->as_array], [map {"$_"} @copies], 'as_array');
+is_deeply([map { $_->columns } $gcs->as_array],
+	  [map { $_->columns } @copies], 'columns of clusters');
+is(join('', map { $gcs->item($_) } 0..($gcs->length - 1)), $text, 'item');
+
+my $sub = $gcs->substr(5, 350);
+my $subsub = $sub->substr(4, 300);
+is("$sub|$subsub", substr($text, 6, 350) . '|' . substr($text, 10, 300),
+   'slices of slice');
+
+$gcs->substr(0, 3, 'Python');
+is("$sub|$subsub", substr($text, 6, 350) . '|' . substr($text, 10, 300),
+   'slices are not affected by modified parent');
+is("$gcs", 'Python' . substr($text, 4), 'modified parent');
+
+$sub .= 'x';
+is("$sub|$subsub|$gcs",
+   substr($text, 6, 350) . 'x|' . substr($text, 10, 300) . '|Python' .
+   substr($text, 4), 'parent is not affected by modified slice');
+
+undef $gcs;
+undef $sub;
+is("$subsub", substr($text, 10, 300), 'slice survives others');
+
+my @clusters = Unicode::GCString->new("abc")->as_array;
+$clusters[1]->substr(0, 1, "\x{3000}");
+is(join('', @clusters), "a\x{3000}c", 'cluster survives its parent');
+
+1;
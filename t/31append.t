@@ -0,0 +1,43 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 7 }
+
+my $gcs = Unicode::GCString->new('abc');
+my $ref = $gcs;
+$gcs .= 'def';
+is("$gcs|$ref", 'abcdef|abc', 'other reference is not affected');
+
+# Clusters across the junction are segmented again.
+my @pieces = ('e', "\x{0301}", ' ', "\x{3042}", "\r", "\n", 'x' x 100,
+	      "\x{0300}\x{0301}", '', "\x{4E00}");
+srand 31;
+my $text = '';
+$gcs = Unicode::GCString->new('');
+for (1..500) {
+    my $piece = $pieces[rand @pieces];
+    $text .= $piece;
+    $gcs .= (rand 2 < 1) ? $piece : Unicode::GCString->new($piece);
+}
+my $new = Unicode::GCString->new($text);
+is("$gcs", $text, 'text');
+is($gcs->length, $new->length, 'number of clusters');
+is($gcs->columns, $new->columns, 'columns');
+is_deeply([map {"$_"} $gcs->as_array], [map {"$_"} $new->as_array],
+	  'clusters');
+
+$gcs = Unicode::GCString->new("\x{3042}" x 300);
+my $sub = $gcs->substr(0, 299);
+$gcs .= $gcs;
+is("$gcs|$sub", ("\x{3042}" x 600) . '|' . ("\x{3042}" x 299),
+   'appending itself');
+
+$sub .= 'x';
+is($gcs->substr(299, 2) . $sub->substr(298), "\x{3042}\x{3042}\x{3042}x",
+   'appending to slice');
+
+1;
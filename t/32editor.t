@@ -0,0 +1,41 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 9 }
+
+my $gcs = Unicode::GCString->new("abc \x{3042}\x{3044} def");
+my $ed = $gcs->editor;
+is($ed->length, 10, 'length');
+is($ed->substr(4, 2, 'xyz')->as_string, "\x{3042}\x{3044}", 'removed');
+is($ed->as_string . '|' . $gcs->as_string,
+   "abc xyz def|abc \x{3042}\x{3044} def", 'original is not affected');
+is($ed->substr(-3)->as_string, 'def', 'negative offset');
+
+# Clusters across the edited boundaries are segmented again.
+my @pieces = ('e', "\x{0301}", ' ', "\x{3042}", "\r", "\n", 'x' x 30,
+	      "\x{0300}\x{0301}", '', "\x{4E00}");
+srand 32;
+$gcs = Unicode::GCString->new('');
+$ed = $gcs->editor;
+my ($pos, $mismatch) = (0, 0);
+for (1..1000) {
+    my $piece = $pieces[rand @pieces];
+    $pos += int(rand 9) - 4;
+    $pos = 0 if $pos < 0;
+    $pos = $gcs->length if $gcs->length < $pos;
+    my $len = int rand 3;
+    my $removed = $ed->substr($pos, $len, $piece);
+    $mismatch++ unless $removed eq $gcs->substr($pos, $len, $piece);
+}
+is($mismatch, 0, 'same as substr() of GCString');
+is($ed->as_string, "$gcs", 'text');
+is($ed->length, $gcs->length, 'number of clusters');
+is_deeply([map {"$_"} $ed->as_gcstring->as_array],
+	  [map {"$_"} $gcs->as_array], 'clusters');
+is($ed->as_gcstring->columns, $gcs->columns, 'columns');
+
+1;
@@ -0,0 +1,43 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 7 }
+
+my $gcs = Unicode::GCString->new("a\x{0301}b \x{3042}\x{4E00}\r\n");
+# Flags are not set on plain strings.
+my @expected = map { ["$_", $_->columns, $_->lbc, 0] } $gcs->as_array;
+
+my @got = ();
+while (my @c = $gcs->next_cluster) {
+    push @got, [@c];
+}
+is_deeply(\@got, \@expected, 'next_cluster');
+ok($gcs->eos, 'next_cluster advances position');
+is(scalar $gcs->next_cluster, undef, 'empty at end');
+
+@got = ();
+$gcs->each_cluster(sub { push @got, [@_] });
+is_deeply(\@got, \@expected, 'each_cluster');
+
+# Callback may release the string.
+my $tmp = Unicode::GCString->new("$gcs");
+@got = ();
+$tmp->each_cluster(sub { push @got, [@_]; undef $tmp });
+is_deeply(\@got, \@expected, 'each_cluster of string released by callback');
+
+my @records = unpack '(L L C C C C)*', $gcs->cluster_records;
+my @offsets = ();
+my $offset = 0;
+foreach my $c ($gcs->as_array) {
+    push @offsets, [$offset, $c->chars, $c->columns, $c->lbc, $c->lbcext, 0];
+    $offset += $c->chars;
+}
+is_deeply([map { [@records[$_ * 6 .. $_ * 6 + 5]] } 0..$#offsets],
+	  \@offsets, 'cluster_records');
+is(Unicode::GCString->new('')->cluster_records, '', 'empty string');
+
+1;
@@ -0,0 +1,29 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 6 }
+
+my $gcs = Unicode::GCString->new("abc \x{3042}");
+my $str = "$gcs";
+$str .= 'x';
+is("$gcs", "abc \x{3042}", 'modifying result does not affect cache');
+
+$gcs->substr(0, 1, 'A');
+is("$gcs", "Abc \x{3042}", 'substr() drops cache');
+$gcs .= "\x{3044}";
+is("$gcs", "Abc \x{3042}\x{3044}", '.= drops cache');
+
+my $copy = $gcs->copy;
+$copy->substr(-1, 1, '');
+is("$gcs|$copy", "Abc \x{3042}\x{3044}|Abc \x{3042}", 'copy');
+
+my $sub = $gcs->substr(1, 2);
+is("$sub", 'bc', 'substring');
+ok("$gcs" eq $gcs->as_string && $gcs eq "Abc \x{3042}\x{3044}",
+   'comparison');
+
+1;
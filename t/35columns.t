@@ -0,0 +1,26 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 6 }
+
+my $gcs = Unicode::GCString->new("ab\x{3042}c\x{0301} \x{4E00}" x 20);
+is($gcs->columns, 160, 'columns');
+
+my @args = ([0], [5], [-3], [3, 10], [3, -4], [100, 100], [-200, 10]);
+is_deeply([map { $gcs->columns(@$_) } @args],
+	  [map { $gcs->substr(@$_)->columns } @args], 'columns of substring');
+
+$gcs .= "\x{3044}";
+is($gcs->columns(-3), 5, 'columns after appending');
+$gcs->substr(0, 2, "\x{3046}");
+is($gcs->columns(0, 3), 5, 'columns after replacement');
+is($gcs->columns, 162, 'total after modifications');
+
+my $short = Unicode::GCString->new("a\x{3042}");
+is($short->columns(1), 2, 'short string');
+
+1;
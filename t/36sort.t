@@ -0,0 +1,54 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 9 }
+
+my @chars = ('a', 'b', 'B', "\x{0301}", "\x{3042}", "\x{FF41}",
+	     "\x{20000}", ' ');
+srand 36;
+my @strs = map {
+    join '', map { $chars[rand @chars] } 0..int(rand 6)
+} 1..300;
+push @strs, '', 'a' x 40, ('a' x 40) . 'b', ('a' x 40) . "\x{3042}";
+
+my ($plain, $object, $cached) = (0, 0, 0);
+foreach my $i (0..$#strs) {
+    my $gcs = Unicode::GCString->new($strs[$i]);
+    my $str = $strs[($i * 7) % scalar @strs];
+    my $expected = $strs[$i] cmp $str;
+    $plain++ unless ($gcs cmp $str) == $expected and
+	($str cmp $gcs) == -$expected;
+    $object++
+	unless ($gcs cmp Unicode::GCString->new($str)) == $expected;
+    my $dummy = "$gcs";
+    $cached++ unless ($gcs cmp $str) == $expected;
+}
+is($plain, 0, 'comparison with Perl strings');
+is($object, 0, 'comparison with objects');
+is($cached, 0, 'comparison by cached UTF-8');
+ok(Unicode::GCString->new("\x{3042}") eq "\x{3042}", 'eq');
+
+my @list = map { (rand 2 < 1) ? Unicode::GCString->new($_) : $_ } @strs;
+Unicode::GCString::sort(\@list);
+is_deeply([map {"$_"} @list], [sort @strs], 'sort');
+
+my @same = map { Unicode::GCString->new('x') } 1..5;
+my @order = map {"$$_"} @same;
+Unicode::GCString::sort(\@same);
+is_deeply([map {"$$_"} @same], \@order, 'stable');
+
+my @holes = ('b');
+$holes[2] = 'a';
+Unicode::GCString::sort(\@holes);
+is_deeply(\@holes, [undef, 'a', 'b'], 'holes');
+eval { $_ .= 'x' foreach @holes };
+is_deeply([$@, @holes], ['', 'x', 'ax', 'bx'], 'holes are modifiable');
+
+eval { Unicode::GCString::sort('abc') };
+like($@, qr/Not array reference/, 'error');
+
+1;
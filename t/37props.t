@@ -0,0 +1,34 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 8 }
+
+my $text = "a\x{0301}b \x{3042}\x{4E00}(1,2)\r\n";
+my $gcs = Unicode::GCString->new($text);
+my @clusters = $gcs->as_array;
+
+is_deeply([unpack 'C*', $gcs->lbc_array], [map { $_->lbc } @clusters],
+	  'lbc_array');
+is_deeply([unpack 'C*', $gcs->lbcext_array], [map { $_->lbcext } @clusters],
+	  'lbcext_array');
+is_deeply([unpack 'S*', $gcs->columns_array],
+	  [map { $_->columns } @clusters], 'columns_array');
+is($gcs->flag_array, "\0" x scalar @clusters, 'flag_array');
+
+my ($lbc, $eaw) = Unicode::LineBreak->classify($text);
+is_deeply([unpack 'C*', $lbc],
+	  [map { Unicode::GCString->new($_)->lbc } split //, $text],
+	  'classify');
+my @first = map { substr "$_", 0, 1 } @clusters;
+my (undef, $firsteaw) = Unicode::LineBreak::classify(join '', @first);
+is($gcs->eaw_array, $firsteaw, 'eaw_array');
+
+my $lb = Unicode::LineBreak->new(LBClass => [ord('a') => LB_ID()]);
+is((unpack 'C', scalar $lb->classify('a')), LB_ID(), 'tailored');
+is(scalar Unicode::LineBreak::classify(''), '', 'empty string');
+
+1;
@@ -0,0 +1,102 @@
+use strict;
+use Test::More;
+
+use FindBin;
+use lib "$FindBin::Bin/..";
+require "t/lb.pl";
+
+BEGIN { plan tests => 14 }
+
+# Line broken at every opportunity gives the same positions.
+my $lb = Unicode::LineBreak->new(BreakIndent => 'YES', ColMax => 1,
+				 Format => undef, Urgent => undef);
+foreach my $text ("Hello world, this is (a) test-case.\nNew line\r\nA" .
+		  "\x{3042}\x{3044}\x{3002}b  c",
+		  "  indented text", "a\x{0301} b\x{0301}\x{0300}c") {
+    my @lines = $lb->break($text);
+    pop @lines;
+    my @expected = ();
+    my $pos = 0;
+    foreach my $line (@lines) {
+	$pos += length "$line";
+	push @expected, $pos;
+    }
+    my $bits = $lb->break_bitmap($text);
+    is_deeply([grep { vec($bits, $_, 1) } 0..length($text) - 1],
+	      \@expected, 'same as break()');
+}
+
+my ($allowed, $mandatory) =
+    Unicode::LineBreak->new->break_bitmap("ab\ncd\r\nef\rg");
+is_deeply([grep { vec($mandatory, $_, 1) } 0..10], [3, 7, 10],
+	  'mandatory breaks');
+is_deeply([grep { vec($allowed, $_, 1) } 0..10], [3, 7, 10],
+	  'mandatory breaks are allowed');
+is(length $allowed, 2, 'size of bitmap');
+is(Unicode::LineBreak->new->break_bitmap(''), '', 'empty string');
+
+$lb = Unicode::LineBreak->new(BreakIndent => 'NO');
+is($lb->break_bitmap('  x'), "\0", 'BreakIndent');
+
+# Offsets where break() breaks lines at every opportunity, and those
+# break_bitmap() gives.
+sub offsets {
+    my ($lb, $text) = @_;
+    my @lines = $lb->break($text);
+    my $pos = 0;
+    my @ret = map { $pos += length "$_" } @lines;
+    pop @ret;
+    return join ',', @ret;
+}
+sub bits {
+    my ($lb, $text) = @_;
+    my $bits = $lb->break_bitmap($text);
+    return join ',', grep { vec($bits, $_, 1) } 0..length($text) - 1;
+}
+
+my @texts = ();
+foreach my $file (sort glob 'test-data/*.in') {
+    open IN, '<', $file or die "open: $!";
+    push @texts, decode_utf8(join '', <IN>);
+    close IN;
+}
+if (open IN, 'test-data/LineBreakTest.txt') {
+    while (<IN>) {
+	s/\s*#.*//;
+	next unless /\S/;
+	push @texts, join '', map { chr hex } /([0-9A-F]+)/g;
+    }
+    close IN;
+}
+srand 38;
+my @chars = ('a', 'Z', '1', ' ', ' ', '(', ')', '-', ',', '.', '!', '$',
+	     "\n", "\r", "\x01", "\x{00A0}", "\x{0301}", "\x{200B}",
+	     "\x{2014}", "\x{3042}", "\x{3002}", "\x{AC00}");
+foreach (1..300) {
+    push @texts, join '', map { $chars[rand @chars] } 1..(1 + int rand 12);
+}
+
+foreach my $indent (qw(YES NO)) {
+    foreach my $legacy (qw(YES NO)) {
+	my $lb = Unicode::LineBreak->new(BreakIndent => $indent,
+					 ColMax => 1,
+					 EAWidth => [[1..65532] => EA_N()],
+					 Format => undef,
+					 LegacyCM => $legacy,
+					 Urgent => undef);
+	my @diff = grep { offsets($lb, $_) ne bits($lb, $_) } @texts;
+	is(scalar @diff, 0,
+	   "same as break() (BreakIndent $indent, LegacyCM $legacy)")
+	    or diag map { sprintf "%s: %s / %s\n",
+			      join(' ', map { sprintf '%04X', ord } split //),
+			      offsets($lb, $_), bits($lb, $_) }
+		    grep { defined } @diff[0..2];
+    }
+}
+
+$lb = Unicode::LineBreak->new(ColMax => 1, Format => undef,
+			      Prep => [qr/a b/, sub { ($_[1]) }]);
+is(bits($lb, 'xa b c'), offsets($lb, 'xa b c'), 'Prep');
+is(bits($lb, 'xa b c'), '5', 'Prep is applied');
+
+1;